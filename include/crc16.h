@@ -0,0 +1,43 @@
+#ifndef _CRC16_H_
+#define _CRC16_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+// Modbus CRC16 (polynomial 0xA001 reflected, initial value 0xFFFF), table driven.
+// A frame followed by its CRC (low byte first) leaves a residue of 0.
+#define CRC16_INIT 0xFFFF
+
+// Table size: 512 bytes byte table by default, define for the 32 bytes nibble table (about half the speed)
+// #define CRC16_NIBBLE_TABLE
+
+// Debug: time the table against the bit by bit CRC on Timer3 at startup, printed on USART0
+// #define CRC16_BENCH
+
+#if defined(CRC16_NIBBLE_TABLE)
+extern const uint16_t crc16_table[16] PROGMEM;
+
+static inline uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+    crc = (crc >> 4) ^ pgm_read_word(&crc16_table[(crc ^ data) & 0x0F]);
+    crc = (crc >> 4) ^ pgm_read_word(&crc16_table[(crc ^ (data >> 4)) & 0x0F]);
+    return crc;
+}
+#else
+extern const uint16_t crc16_table[256] PROGMEM;
+
+static inline uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+    return (crc >> 8) ^ pgm_read_word(&crc16_table[(uint8_t)crc ^ data]);
+}
+#endif
+
+// Fold len bytes of buf into crc
+uint16_t crc16_update_block(uint16_t crc, const volatile uint8_t *buf, uint16_t len);
+
+#if defined(CRC16_BENCH)
+// Same CRC one bit at a time, the reference the tables are measured against
+uint16_t crc16_bitwise_block(uint16_t crc, const volatile uint8_t *buf, uint16_t len);
+#endif
+
+#endif // !_CRC16_H_
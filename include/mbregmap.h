@@ -0,0 +1,138 @@
+#ifndef _MBREGMAP_H_
+#define _MBREGMAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Modbus register map.
+ *
+ * The map is a table in flash, sorted by register address. Every entry binds one
+ * value of the application to one or more consecutive registers:
+ *
+ *  MBREG_U32(0, g_pulses0, MB_RW, validateReset),   // 2 registers, pointer, write validated
+ *  MBREG_GET(8, MB_FLOAT, MB_RO, getMeanPeriod),    // 2 registers, getter
+ *
+ * Reads serialize straight from the variables (or getters), there is no shadow
+ * register array. All variables of a read are copied in one critical section first.
+ * Getters are called after it, with interrupts enabled: a getter reading more than
+ * one variable takes its own atomic snapshot of them. Writes are accepted
+ * for whole values only, every value is checked by its validator before any of
+ * them is stored.
+ */
+
+// data types, and the number of registers they take
+enum
+{
+    MB_U16,   // 1 register
+    MB_U32,   // 2 registers
+    MB_FLOAT, // 2 registers, IEEE 754
+    MB_I64    // 4 registers
+};
+
+// access and word order flags
+#define MB_RO 0x01
+#define MB_WO 0x02
+#define MB_RW (MB_RO | MB_WO)
+#define MB_LSW_FIRST 0x10 // least significant word in the lower register, default is most significant first
+#define MB_ACTIVE_LOW 0x20 // coils and discrete inputs: the pin is low when the bit is 1
+
+typedef struct
+{
+    uint16_t address;                       // first register
+    uint8_t type;                           // MB_U16 ... MB_I64
+    uint8_t flags;                          // MB_RO, MB_WO, MB_LSW_FIRST
+    void *var;                              // the value, NULL when read by getter
+    void (*get)(void *value);               // getter, used when var is NULL
+    bool (*validate)(const void *value);    // optional, a write is refused when it returns false
+} mbReg_t;
+
+#define MBREG(addr, t, fl, v, g, val) \
+    {                                 \
+        (addr), (t), (fl), (v), (g), (val)}
+#define MBREG_U16(addr, var, fl, val) MBREG(addr, MB_U16, fl, (void *)&(var), NULL, val)
+#define MBREG_U32(addr, var, fl, val) MBREG(addr, MB_U32, fl, (void *)&(var), NULL, val)
+#define MBREG_FLOAT(addr, var, fl, val) MBREG(addr, MB_FLOAT, fl, (void *)&(var), NULL, val)
+#define MBREG_I64(addr, var, fl, val) MBREG(addr, MB_I64, fl, (void *)&(var), NULL, val)
+#define MBREG_GET(addr, t, fl, getter) MBREG(addr, t, (fl) & ~MB_WO, NULL, getter, NULL)
+
+typedef struct
+{
+    const __flash mbReg_t *regs; // sorted by address, no overlaps
+    uint8_t count;
+} mbRegMap_t;
+
+// coils and discrete inputs, one pin each
+typedef struct
+{
+    uint16_t address; // coil or discrete input number
+    uint16_t pin;     // avr8gpio pin, DOUT0 ...
+    uint8_t flags;    // MB_RO, MB_WO, MB_ACTIVE_LOW
+} mbBit_t;
+
+#define MBBIT(addr, p, fl) \
+    {                      \
+        (addr), (p), (fl)}
+
+typedef struct
+{
+    const __flash mbBit_t *bits; // sorted by address
+    uint8_t count;
+} mbBitMap_t;
+
+// files for the file record functions (FC20/FC21), records of 2 bytes
+typedef struct
+{
+    uint16_t file;    // file number, 1 ...
+    uint8_t flags;    // MB_RO, MB_WO
+    uint8_t *ee;      // EEPROM address of record 0
+    uint16_t records; // size of the file
+} mbFile_t;
+
+typedef struct
+{
+    const __flash mbFile_t *files;
+    uint8_t count;
+} mbFileMap_t;
+
+// device identification objects (FC43/14)
+#define MB_OBJ_VENDOR 0x00
+#define MB_OBJ_PRODUCT 0x01
+#define MB_OBJ_REVISION 0x02
+#define MB_OBJ_SERIAL 0x80 // first extended object, the individual number of the meter
+
+// Modbus exception codes returned by the map functions, 0 on success
+#define MB_EX_NONE 0
+#define MB_EX_ILLEGAL_FUNCTION 1
+#define MB_EX_ILLEGAL_ADDRESS 2
+#define MB_EX_ILLEGAL_VALUE 3
+#define MB_EX_DEVICE_FAILURE 4
+
+// serialize count registers from start into out (2 * count bytes, big endian registers)
+uint8_t mbRegRead(const __flash mbRegMap_t *map, uint16_t start, uint16_t count, uint8_t *out);
+// validate and store count registers from start, taken from in (2 * count bytes)
+uint8_t mbRegWrite(const __flash mbRegMap_t *map, uint16_t start, uint16_t count, const uint8_t *in);
+
+// pack count bits from start into out, first bit in the LSB of out[0]
+uint8_t mbBitRead(const __flash mbBitMap_t *map, uint16_t start, uint16_t count, uint8_t *out);
+// set count bits from start, packed the same way in in
+uint8_t mbBitWrite(const __flash mbBitMap_t *map, uint16_t start, uint16_t count, const uint8_t *in);
+
+// check that count records from record exist in the file and allow access (MB_RO or MB_WO)
+uint8_t mbFileCheck(const __flash mbFileMap_t *map, uint16_t file, uint16_t record, uint16_t count, uint8_t access);
+// copy count records to out, or store them from in, bytes in file order
+uint8_t mbFileRead(const __flash mbFileMap_t *map, uint16_t file, uint16_t record, uint16_t count, uint8_t *out);
+uint8_t mbFileWrite(const __flash mbFileMap_t *map, uint16_t file, uint16_t record, uint16_t count, const uint8_t *in);
+
+// the maps of the application, in regmap.c
+extern const __flash mbRegMap_t mbHoldingMap;
+extern const __flash mbRegMap_t mbInputMap;
+extern const __flash mbBitMap_t mbCoilMap;
+extern const __flash mbBitMap_t mbDiscreteMap;
+extern const __flash mbFileMap_t mbFileMap;
+
+// Copy up to size bytes of the device identification object to buf, in regmap.c.
+// Return the length of the whole object, 0 if there is no such object.
+uint8_t mbDeviceObject(uint8_t id, uint8_t *buf, uint8_t size);
+
+#endif // !_MBREGMAP_H_
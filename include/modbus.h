@@ -5,28 +5,122 @@ Licensed under LGPL.
 **/
 #ifndef __modbus_H
 #define __modbus_H
+
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
-// #include "cmsis_os.h"
-// 3,5 character timeout or frame timeout
-// This value for 9600 speed and 1000Hz tick counter
-#define ModBus35 35
-// How many holding registers we are serve?
-#define ModBusRegisters 10 // 0-9
-   // message queue for outgoing bytes
-   extern QueueHandle_t ModBusInHandle;
-   // message queue for outgoing bytes
-   extern QueueHandle_t ModBusOutHandle;
-   // just start it before scheduler
-   void ModBus_Init(void);
+// RTU lines on USART0 (service) and USART1 (plant), 8N1, default baud rates
+#define ModBusPorts 2
+#define ModBusBaud0 19200UL
+#define ModBusBaud 9600UL
+// 1,5 and 3,5 character timeouts in us, 11 bit characters.
+// Fixed 750us and 1750us above 19200 baud, as the Modbus serial line specification asks.
+#define ModBus15_US(baud) (((baud) > 19200UL) ? 750UL : (16500000UL / (baud)))
+#define ModBus35_US(baud) (((baud) > 19200UL) ? 1750UL : (38500000UL / (baud)))
+// The silence is timed by Timer3 output compare C (USART0) and B (USART1). Timer3 runs free at F_CPU (clk/1), see boardInit().
+#if defined(__AVR__)
+#define ModBusTimerHz F_CPU
+#else
+#define ModBusTimerHz 1000000UL // host build: the clock counts us
+#endif
+#define ModBusUsToCounts(us) ((uint32_t)(ModBusTimerHz / 1000000UL) * (us))
+#define ModBusCountsToUs(counts) ((counts) / (uint32_t)(ModBusTimerHz / 1000000UL))
+// Largest RTU frame (ADU): address, PDU of 253 bytes, CRC
+#define ModBusFrameSize 256
+// RS485 transceiver driver enable, avr8gpio pin, 0 if the port has none
+#define ModBusDE0 0
+#define ModBusDE1 GPA0
+#define ModBusFileRequests 8 // sub-requests in one FC20 request
+#define ModBusHistBins 8 // turnaround histogram: <1ms, 1-2ms, 2-4ms ... 64ms and more
+
+   // diagnostic counters of a slave port (FC08) and turnaround statistics
+   typedef struct
+   {
+      uint16_t bus_msg;    // frames seen on the line
+      uint16_t crc_err;    // frames dropped for CRC, framing, parity or length errors
+      uint16_t exceptions; // exception answers sent
+      uint16_t server_msg; // frames addressed to us
+      uint16_t no_resp;    // frames addressed to us without answer
+      uint16_t overrun;    // characters lost, or frames too long
+      uint16_t foreign;    // frames for other slaves
+      uint32_t rx_end;     // last answered frame: last byte of the request, Timer3 counts
+      uint32_t parse_done; // answer built
+      uint32_t tx_start;   // first byte of the answer
+      uint16_t lat_min;    // turnaround from rx_end to tx_start, us
+      uint16_t lat_avg;
+      uint16_t lat_max;
+      uint16_t lat_count;
+      uint32_t lat_sum;
+      uint16_t hist[ModBusHistBins];
+   } mbDiag_t;
+
+   extern mbDiag_t mbDiag[ModBusPorts];
+
+   // just start it before scheduler, once per port (0 for USART0, 1 for USART1).
+   // access is MB_RO or MB_RW (mbregmap.h), a read only port refuses all writes.
+   void ModBus_Init(uint8_t port, uint8_t addr, uint32_t baud, uint8_t access);
    // set our address
-   void ModBus_SetAddress(uint8_t addr);
-   // set value of register
-   void ModBus_SetRegister(uint8_t reg, uint16_t value);
-   // grab value of register
-   uint16_t ModBus_GetRegister(uint8_t reg);
+   void ModBus_SetAddress(uint8_t port, uint8_t addr);
+   // registers served are described by the register map, see mbregmap.h
+   // change the baud rate, the T1.5 and T3.5 timeouts follow
+   void ModBus_SetBaud(uint8_t port, uint32_t baud);
+
+// Master side, modbus_master.c. The answer to a request must end within this time
+// after the request is sent, on top of the time the two frames take on the line.
+#define ModBusMasterTimeoutMs 100
+#define ModBusMasterRetries 2 // repeated requests after a timeout or a broken answer
+#define ModBusPollValues 8    // 32 bit values collected from the downstream devices
+#define ModBusPollLines 16    // schedule lines, one bit each in mbPollValid
+
+   // one line of the poll schedule
+   typedef struct
+   {
+      uint8_t slave;   // address of the downstream device
+      uint8_t func;    // 3 holding or 4 input registers
+      uint16_t start;  // first register on the device
+      uint8_t count;   // registers, two per value, most significant word first: even
+      uint16_t period; // ms between two polls
+      uint8_t dest;    // first value in mbPollData
+   } mbPoll_t;
+
+   typedef struct
+   {
+      const __flash mbPoll_t *polls;
+      uint8_t count; // up to ModBusPollLines
+   } mbPollSchedule_t;
+
+   // values collected by the master, and a bit per schedule line set while its last poll succeeded
+   extern volatile uint32_t mbPollData[ModBusPollValues];
+   extern volatile uint16_t mbPollValid;
+
+   // the schedule of the application, in regmap.c
+   extern const __flash mbPollSchedule_t mbPollSchedule;
+
+   // just start it before scheduler, the port is then polled by the master instead of served.
+   // false and nothing started when a line of the schedule does not fit mbPollData or mbPollValid.
+   bool ModBus_InitMaster(uint8_t port, uint32_t baud, const __flash mbPollSchedule_t *schedule);
+
+#if !defined(__AVR__)
+   // Host build: serve the port on a new pseudo terminal, return the name of its
+   // slave side for the test client, NULL on failure.
+   const char *ModBus_HostOpen(uint8_t port, uint8_t addr, uint32_t baud, uint8_t access);
+   // wait up to timeout_ms for a frame and answer it, false when nothing came
+   bool ModBus_HostServe(uint8_t port, uint32_t timeout_ms);
+#endif
+
+   // Frame level access for the master task. Open the port for a task, send the
+   // request built in the buffer (CRC appended), wait for the answer: its length
+   // without CRC, 0 on timeout or a broken frame.
+   void ModBus_Open(uint8_t port, uint32_t baud, TaskHandle_t task);
+   uint8_t *ModBus_Buffer(uint8_t port);
+   void ModBus_Send(uint8_t port, uint16_t len);
+   uint16_t ModBus_Receive(uint8_t port, TickType_t timeout);
 #ifdef __cplusplus
 }
 #endif
@@ -21,6 +21,14 @@ enum
 #define EV_GTOTALRESET (1 << 1)
 #define EV_PASSTIMEOUT (1 << 7)
 
+// counters and period measurement, updated by the input ISRs in main.c
+extern volatile uint16_t g_periodH;
+extern volatile uint16_t g_timer3H; // Timer3 overflows, never reset
+extern volatile uint32_t g_period;
+extern volatile uint32_t g_pulses0;
+extern volatile uint32_t g_pulses1;
+extern volatile uint32_t g_pulses2;
+extern volatile uint32_t g_pulses3;
 
 void prvBeepEnable(BaseType_t tone, uint16_t duration);
 
@@ -15,37 +15,18 @@
 
 uint8_t MCP401x_GetWiperValue(void)
 {
-    uint8_t I2C_command_buf[2];
-    if (xI2CSemaphore != NULL) // use the xI2CSemaphore if you're sharing the I2C bus.
-    {
-        // See if we can obtain the semaphore.  If the semaphore is not available
-        // wait 10 ticks to see if it becomes free.
-        if (xSemaphoreTake(xI2CSemaphore, (TickType_t)10) == pdTRUE)
-        {
-            I2C_command_buf[0] = MCP401x_I2C_ADDRESS + I2C_READ;
-            I2C_Master_Start_Transceiver_With_Data((uint8_t *)&I2C_command_buf, 1);
-            I2C_Master_Get_Data_From_Transceiver((uint8_t *)&I2C_command_buf, 2);
-            xSemaphoreGive(xI2CSemaphore);
-            return I2C_command_buf[1];
-        }
-    }
-    return pdTRUE;
+    uint8_t wiper;
+    I2C_Transaction_t xTransaction = {MCP401x_I2C_ADDRESS, NULL, 0, &wiper, 1};
+
+    // I2C_Master_Transfer() takes the xI2CSemaphore and gives up after I2C_WORST_CASE_US().
+    if (I2C_Master_Transfer(&xTransaction))
+        return wiper;
+    return MCP401x_ERROR;
 }
 
-void MCP401x_SetWiperValue(uint8_t data)
+uint8_t MCP401x_SetWiperValue(uint8_t data)
 {
-    uint8_t I2C_command_buf[2];
-    if (xI2CSemaphore != NULL) // use the xI2CSemaphore if you're sharing the I2C bus.
-    {
-        // See if we can obtain the semaphore.  If the semaphore is not available
-        // wait 10 ticks to see if it becomes free.
-        if (xSemaphoreTake(xI2CSemaphore, (TickType_t)10) == pdTRUE)
-        {
-            I2C_command_buf[0] = MCP401x_I2C_ADDRESS + I2C_WRITE;
-            I2C_command_buf[1] = data;
-            I2C_Master_Start_Transceiver_With_Data((uint8_t *)&I2C_command_buf, 2);
-            xSemaphoreGive(xI2CSemaphore);
-        }
-    }
-    return pdTRUE;
+    I2C_Transaction_t xTransaction = {MCP401x_I2C_ADDRESS, &data, 1, NULL, 0};
+
+    return I2C_Master_Transfer(&xTransaction);
 }
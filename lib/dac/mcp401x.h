@@ -4,8 +4,9 @@
 #include "FreeRTOS.h"
 
 #define MCP401x_I2C_ADDRESS 0x5E // (0x2F unshifted)
+#define MCP401x_ERROR 0xFF       // wiper is 7-bit, returned when the read failed
 
-uint8_t MCP401x_GetWiperValue(void);      // get wiper value
-void MCP401x_SetWiperValue(uint8_t data); // set resistance value
+uint8_t MCP401x_GetWiperValue(void);         // get wiper value
+uint8_t MCP401x_SetWiperValue(uint8_t data); // set resistance value, pdFALSE on failure
 
 #endif // _MCP401x_H_
\ No newline at end of file
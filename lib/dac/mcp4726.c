@@ -2,7 +2,9 @@
  * by magner 2024
  */
 
+#if defined(__AVR__)
 #include <avr/delay.h>
+#endif
 /* Scheduler include files. */
 #include "FreeRTOS.h"
 #include "task.h"
@@ -14,27 +16,21 @@
 
 #include "mcp4726.h"
 
-void MCP4726_SetOutput(uint16_t data // 0...4095
+uint8_t MCP4726_SetOutput(uint16_t data // 0...4095
 )
 {
-    uint8_t I2C_command_buf[4];
-    if (xI2CSemaphore != NULL) // use the xI2CSemaphore if you're sharing the I2C bus.
-    {
-        // See if we can obtain the semaphore.  If the semaphore is not available
-        // wait 10 ticks to see if it becomes free.
-        if (xSemaphoreTake(xI2CSemaphore, (TickType_t)10) == pdTRUE)
-        {
-            I2C_command_buf[0] = MCP4726_I2C_ADDRESS + I2C_WRITE;
-            I2C_command_buf[1] = 0b01011000; // Mode setup
-            I2C_command_buf[2] = (uint8_t)(data >> 4);
-            I2C_command_buf[3] = (uint8_t)(data << 4);
-            I2C_Master_Start_Transceiver_With_Data((uint8_t *)&I2C_command_buf, 4);
-            xSemaphoreGive(xI2CSemaphore);
-        }
-    }
-    return pdTRUE;
+    uint8_t I2C_command_buf[3];
+    I2C_Transaction_t xTransaction = {MCP4726_I2C_ADDRESS, I2C_command_buf, sizeof(I2C_command_buf), NULL, 0};
+
+    I2C_command_buf[0] = 0b01011000; // Mode setup
+    I2C_command_buf[1] = (uint8_t)(data >> 4);
+    I2C_command_buf[2] = (uint8_t)(data << 4);
+
+    // I2C_Master_Transfer() takes the xI2CSemaphore and gives up after I2C_WORST_CASE_US().
+    return I2C_Master_Transfer(&xTransaction);
 }
 
+#if defined(__AVR__) // TWI registers, no i2cSim.c equivalent
 static void I2C_Start()
 {
     TWCR = ((1 << TWINT) | (1 << TWSTA) | (1 << TWEN));
@@ -74,5 +70,6 @@ void DAC_SetOutput(uint16_t data)
             xSemaphoreGive(xI2CSemaphore);
         }
     }
-    return pdTRUE;
 }
+
+#endif // __AVR__
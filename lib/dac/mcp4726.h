@@ -5,7 +5,7 @@
 
 #define MCP4726_I2C_ADDRESS 0xC0 // (0x60 unshifted)
 
-void MCP4726_SetOutput(uint16_t data);
+uint8_t MCP4726_SetOutput(uint16_t data); // pdFALSE on failure
 
 // Function that works without waiting for the device to be ready
 void DAC_SetOutput(uint16_t data);
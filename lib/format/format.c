@@ -0,0 +1,139 @@
+/*
+ * format.c
+ *
+ *  Compact number formatting, see format.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <avr/pgmspace.h>
+
+#include "format.h"
+
+static const __flash uint32_t pow10[FMT_FRAC_MAX + 1] = {
+	1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL, 100000000UL, 1000000000UL};
+
+static const __flash char hexDigits[] = "0123456789abcdef";
+
+// digits of val with a point before the last frac ones, then sign and padding up to width
+static char *fmtNumber(char *dst, uint32_t val, char sign, uint8_t frac, uint8_t width, char pad)
+{
+	char tmp[11]; // the digits of a uint32_t and the point, least significant first
+	uint8_t n = 0;
+	uint8_t digits = 0;
+	uint8_t len;
+
+	if (frac > FMT_FRAC_MAX)
+		frac = FMT_FRAC_MAX;
+	do
+	{
+		if (frac && digits == frac)
+			tmp[n++] = '.';
+		tmp[n++] = '0' + val % 10;
+		val /= 10;
+		digits++;
+	} while (val || digits <= frac);
+
+	len = n + (sign ? 1 : 0);
+	if (sign && pad == '0')
+		*dst++ = sign;
+	while (width > len)
+	{
+		*dst++ = pad;
+		width--;
+	}
+	if (sign && pad != '0')
+		*dst++ = sign;
+	while (n)
+		*dst++ = tmp[--n];
+	*dst = 0;
+	return dst;
+}
+
+char *fmtUDec(char *dst, uint32_t val, uint8_t width, char pad)
+{
+	return fmtNumber(dst, val, 0, 0, width, pad);
+}
+
+char *fmtDec(char *dst, int32_t val, uint8_t width, char pad, bool plus)
+{
+	return fmtFix(dst, val, 0, width, pad, plus);
+}
+
+char *fmtFix(char *dst, int32_t val, uint8_t frac, uint8_t width, char pad, bool plus)
+{
+	if (val < 0)
+		return fmtNumber(dst, -(uint32_t)val, '-', frac, width, pad);
+	return fmtNumber(dst, val, plus ? '+' : 0, frac, width, pad);
+}
+
+char *fmtFloat(char *dst, float val, uint8_t frac, uint8_t width, char pad, bool plus)
+{
+	char sign = plus ? '+' : 0;
+	uint32_t scale;
+	uint32_t ipart;
+	uint32_t fpart;
+
+	if (isnan(val))
+		return fmtStr_P(dst, PSTR("nan"));
+	if (frac > FMT_FRAC_MAX)
+		frac = FMT_FRAC_MAX;
+	scale = pow10[frac];
+	if (val < 0)
+	{
+		val = -val;
+		sign = '-';
+	}
+	// 2^32 is exact in a float, anything below it converts to a uint32_t (infinity does not)
+	if (val >= 4294967296.0f)
+		return fmtNumber(dst, UINT32_MAX / scale * scale, sign, frac, width, pad);
+	// scale the integer and the fraction parts apart, so the 24 bit mantissa is spent on the digits shown
+	ipart = (uint32_t)val;
+	fpart = (uint32_t)((val - ipart) * scale + 0.5f);
+	if (fpart >= scale)
+	{
+		ipart++; // the largest float below 2^32 is 2^32 - 256, this never wraps
+		fpart -= scale;
+	}
+	// the limit is checked on the integers, a float threshold rounds
+	if ((ipart > UINT32_MAX / scale) || ((ipart == UINT32_MAX / scale) && (fpart > UINT32_MAX % scale)))
+		return fmtNumber(dst, UINT32_MAX / scale * scale, sign, frac, width, pad);
+	return fmtNumber(dst, ipart * scale + fpart, sign, frac, width, pad);
+}
+
+char *fmtHex(char *dst, uint32_t val, uint8_t digits)
+{
+	char tmp[8]; // the nibbles of a uint32_t, least significant first
+	uint8_t n = 0;
+
+	do
+	{
+		tmp[n++] = hexDigits[val & 0x0F];
+		val >>= 4;
+	} while (val);
+
+	while (digits > n)
+	{
+		*dst++ = '0';
+		digits--;
+	}
+	while (n)
+		*dst++ = tmp[--n];
+	*dst = 0;
+	return dst;
+}
+
+char *fmtStr(char *dst, const char *str)
+{
+	while ((*dst = *str++))
+		dst++;
+	return dst;
+}
+
+char *fmtStr_P(char *dst, PGM_P str)
+{
+	while ((*dst = pgm_read_byte(str++)))
+		dst++;
+	return dst;
+}
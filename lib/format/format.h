@@ -0,0 +1,41 @@
+/*
+ * format.h
+ *
+ *  Compact number formatting for the LCD and serial buffers, in place of
+ *  vsnprintf() on the display refresh path. Each function writes at dst,
+ *  zero terminates, and returns a pointer to the terminator so calls chain.
+ *
+ *  Padding follows printf: with pad '0' the sign comes before the zeros,
+ *  with pad ' ' the spaces come before the sign. A width of 0, or one the
+ *  text already fills, adds no padding.
+ */
+
+#ifndef FORMAT_H_
+#define FORMAT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+
+#define FMT_FRAC_MAX 9 // most fraction digits fmtFix() and fmtFloat() write
+
+// unsigned decimal, "%*lu" / "%0*lu"
+char *fmtUDec(char *dst, uint32_t val, uint8_t width, char pad);
+
+// signed decimal, "%*ld" / "%0*ld", plus forces a '+' on positive values
+char *fmtDec(char *dst, int32_t val, uint8_t width, char pad, bool plus);
+
+// fixed point: val holds the number times 10^frac, written with frac digits after the point
+char *fmtFix(char *dst, int32_t val, uint8_t frac, uint8_t width, char pad, bool plus);
+
+// "%*.*f", values that do not fit a uint32_t once scaled are clamped, NaN is written as "nan"
+char *fmtFloat(char *dst, float val, uint8_t frac, uint8_t width, char pad, bool plus);
+
+// lower case hex, zero padded to digits, 0 for no padding
+char *fmtHex(char *dst, uint32_t val, uint8_t digits);
+
+// string copy from RAM or PROGMEM
+char *fmtStr(char *dst, const char *str);
+char *fmtStr_P(char *dst, PGM_P str);
+
+#endif // FORMAT_H_
@@ -5,13 +5,18 @@
  * Description       : This is a sample driver for the TWI hardware modules.
  *                     It is interrupt driven. All functionality is controlled through
  *                     passing information to and from functions.
+ *                     The bounded-latency I2C_Master_Transfer() and the statistics
+ *                     built on top of it are in i2cTransfer.c. Host builds compile
+ *                     this file against the simulated TWI registers of i2cSim.c.
  *
  ****************************************************************************/
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include <avr/interrupt.h>
+#include <util/delay.h>
 
 /* Scheduler include files. */
 #include "FreeRTOS.h"
@@ -23,15 +28,37 @@ SemaphoreHandle_t xI2CSemaphore = NULL;
 
 static uint8_t I2C_buf[I2C_BUFFER_SIZE]; // Transceiver buffer
 static uint8_t I2C_msgSize;				 // Number of bytes to be transmitted.
+static uint8_t I2C_wrSize;				 // Number of bytes in the write phase, the read phase (if any) follows in I2C_buf.
+static uint8_t I2C_rdPhase;				 // Set when the repeated START of a combined transaction has been requested.
 static uint8_t I2C_state = I2C_NO_STATE; // State byte. Default set to I2C_NO_STATE.
 
 static uint8_t I2C_checkBusyAfterStop = 0; // Number of busy check times following a Stop_Restart xA0
+static uint8_t I2C_retries;				   // START attempts left after NACK or lost arbitration.
 
 union I2C_statusReg I2C_statusReg = {0}; // I2C_statusReg is defined in i2cMultiMaster.h
 
-/* Private Functions */
+#define I2C_HALF_CLOCK_US (500000UL / SCL_CLOCK) // Half SCL period for the bit-banged bus recovery.
 
-static uint8_t I2C_Transceiver_Busy(void) __attribute__((flatten));
+#define I2C_SCL_LOW()                     \
+	{                                     \
+		I2C_PORT &= ~I2C_BIT_SCL;         \
+		I2C_PORT_DIR |= I2C_BIT_SCL;      \
+	}
+#define I2C_SCL_RELEASE()                 \
+	{                                     \
+		I2C_PORT_DIR &= ~I2C_BIT_SCL;     \
+		I2C_PORT |= I2C_BIT_SCL;          \
+	}
+#define I2C_SDA_LOW()                     \
+	{                                     \
+		I2C_PORT &= ~I2C_BIT_SDA;         \
+		I2C_PORT_DIR |= I2C_BIT_SDA;      \
+	}
+#define I2C_SDA_RELEASE()                 \
+	{                                     \
+		I2C_PORT_DIR &= ~I2C_BIT_SDA;     \
+		I2C_PORT |= I2C_BIT_SDA;          \
+	}
 
 /****************************************************************************
  * Call this function to set up the TWI slave to its initial standby state.
@@ -128,6 +155,8 @@ void I2C_Master_Start_Transceiver(void)
 		; // Wait until TWI is ready for next transmission.
 	I2C_statusReg.all = 0;
 	I2C_state = I2C_NO_STATE;
+	I2C_rdPhase = false;
+	I2C_retries = I2C_MAX_RETRIES;
 	TWCR = (1 << TWEN) |							   // TWI Interface enabled.
 		   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag.
 		   (1 << TWEA) | (1 << TWSTA) | (0 << TWSTO) | // Initiate a START condition.
@@ -175,6 +204,7 @@ void I2C_Master_Start_Transceiver_With_Data(uint8_t *msg, uint8_t msgSize)
 		; // Wait until TWI is ready for next transmission.
 
 	I2C_msgSize = msgSize; // Number of data to transmit.
+	I2C_wrSize = msgSize;  // Single phase, no repeated START.
 	I2C_buf[0] = msg[0];   // Store slave address with R/W setting.
 
 	if ((msg[0] & (true << I2C_READ_BIT)) == false) // If it is a write operation, then also copy data.
@@ -183,12 +213,78 @@ void I2C_Master_Start_Transceiver_With_Data(uint8_t *msg, uint8_t msgSize)
 
 	I2C_statusReg.all = 0;
 	I2C_state = I2C_NO_STATE;
+	I2C_rdPhase = false;
+	I2C_retries = I2C_MAX_RETRIES;
+	TWCR = (1 << TWEN) |							   // TWI Interface enabled.
+		   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag.
+		   (0 << TWEA) | (1 << TWSTA) | (0 << TWSTO) | // Initiate a START condition.
+		   (0 << TWWC);								   //
+}
+
+/****************************************************************************
+Call this function to start a master transaction described by an I2C_Transaction_t. The write
+phase (if any) is copied to the transceiver buffer, followed by the slave address for the read
+phase. When both phases are present the ISR joins them with a repeated START, so a register read
+costs one START ... STOP frame and one call instead of two separate transceiver runs.
+The function will hold execution (loop) until the I2C_ISR has completed with the previous operation,
+then initialise the next operation and return.
+****************************************************************************/
+void I2C_Master_Start_Transaction(const I2C_Transaction_t *xfer)
+{
+	uint8_t i;
+
+	while (I2C_Transceiver_Busy())
+		; // Wait until TWI is ready for next transmission.
+
+	if (xfer->txSize)
+	{
+		I2C_buf[0] = xfer->address | I2C_WRITE; // Slave address for the write phase.
+		for (i = 0; i < xfer->txSize; i++)
+			I2C_buf[i + 1] = xfer->txData[i];
+		I2C_wrSize = xfer->txSize + 1;
+
+		if (xfer->rxSize)
+		{
+			I2C_buf[I2C_wrSize] = xfer->address | I2C_READ; // Slave address sent after the repeated START.
+			I2C_msgSize = I2C_wrSize + 1 + xfer->rxSize;
+		}
+		else
+			I2C_msgSize = I2C_wrSize;
+	}
+	else // Plain read, same layout as I2C_Master_Start_Transceiver_With_Data().
+	{
+		I2C_buf[0] = xfer->address | I2C_READ;
+		I2C_msgSize = xfer->rxSize + 1;
+		I2C_wrSize = I2C_msgSize;
+	}
+
+	I2C_statusReg.all = 0;
+	I2C_state = I2C_NO_STATE;
+	I2C_rdPhase = false;
+	I2C_retries = I2C_MAX_RETRIES;
 	TWCR = (1 << TWEN) |							   // TWI Interface enabled.
 		   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag.
 		   (0 << TWEA) | (1 << TWSTA) | (0 << TWSTO) | // Initiate a START condition.
 		   (0 << TWWC);								   //
 }
 
+/****************************************************************************
+Call this function to collect the read phase of a transaction started with I2C_Master_Start_Transaction().
+The received bytes (without any address byte) are copied to xfer->rxData. The function will hold
+execution (loop) until the I2C_ISR has completed with the operation. Returns lastTransOK.
+****************************************************************************/
+uint8_t I2C_Master_Get_Data_From_Transaction(const I2C_Transaction_t *xfer)
+{
+	while (I2C_Transceiver_Busy())
+		; // Wait until TWI is ready for next transmission.
+
+	if (I2C_statusReg.lastTransOK)					   // Last transmission completed successfully.
+		for (uint8_t i = 0; i < xfer->rxSize; i++)	   // Read phase sits at the end of the Transceiver buffer.
+			xfer->rxData[i] = I2C_buf[I2C_msgSize - xfer->rxSize + i];
+
+	return (I2C_statusReg.lastTransOK);
+}
+
 /****************************************************************************
  * Call this function to read out the received data from the TWI transceiver buffer. I.e. first
  * call I2C_Start_Transceiver to get the TWI Transceiver to fetch data. Then Run this function to
@@ -250,19 +346,78 @@ uint8_t I2C_Transceiver_Busy(void)
 uint8_t I2C_Check_Free_After_Stop(void) //
 {
 	//	I2C_checkBusyAfterStop = I2C_HOW_MANY_BUSY_CHECKS_AFTER_STOP;
+	TickType_t start = xTaskGetTickCount();
 
 	while (I2C_checkBusyAfterStop > 0) // Call repeatedly
 	{
-		if ((~(I2C_PORT_STATUS) && (I2C_BIT_SCL | I2C_BIT_SDA)) == 0) // both SCL and SDA should be high on idle bus.
+		if ((~(I2C_PORT_STATUS) & (I2C_BIT_SCL | I2C_BIT_SDA)) == 0) // both SCL and SDA should be high on idle bus.
 			// Good. The bus is quiet. Count down!
 			--I2C_checkBusyAfterStop;
 		else
-			// Bus is busy. Start the count down all over again.
+		{
+			// Bus is busy. Start the count down all over again, but not forever.
 			I2C_checkBusyAfterStop = I2C_HOW_MANY_BUSY_CHECKS_AFTER_STOP;
+			if ((TickType_t)(xTaskGetTickCount() - start) >= I2C_US_TO_TICKS(I2C_BUS_FREE_TIMEOUT_US))
+				return false;
+			_delay_us(I2C_POLL_US);
+		}
 	}
 	return true;
 }
 
+/****************************************************************************
+Call this function to free a stuck bus. A slave that was interrupted in the middle of a byte may
+hold SDA low forever. The TWI module is switched off and the slave gets I2C_STRETCH_ALLOWANCE_US
+to release SDA by itself. Only if SDA is still held low after that, SCL is clocked by hand until
+the slave lets go (9 clocks at most) and a STOP is generated. The TWI module is enabled again.
+Returns true if both lines are high afterwards.
+****************************************************************************/
+uint8_t I2C_Bus_Recover(void)
+{
+	TickType_t start;
+	uint8_t i;
+
+	TWCR = 0; // Disable the TWI module, the pins become plain port pins.
+	I2C_SDA_RELEASE();
+	I2C_SCL_RELEASE();
+
+	start = xTaskGetTickCount();
+	while (!(I2C_PORT_STATUS & I2C_BIT_SDA) &&
+		   ((TickType_t)(xTaskGetTickCount() - start) < I2C_US_TO_TICKS(I2C_STRETCH_ALLOWANCE_US)))
+		_delay_us(I2C_POLL_US);
+
+	if (!(I2C_PORT_STATUS & I2C_BIT_SDA)) // Still held low, clock the slave out of its byte.
+	{
+		for (i = 0; (i < 9) && !(I2C_PORT_STATUS & I2C_BIT_SDA); i++)
+		{
+			I2C_SCL_LOW();
+			_delay_us(I2C_HALF_CLOCK_US);
+			I2C_SCL_RELEASE();
+			_delay_us(I2C_HALF_CLOCK_US);
+		}
+
+		// STOP condition: SDA rising while SCL is high.
+		I2C_SCL_LOW();
+		_delay_us(I2C_HALF_CLOCK_US);
+		I2C_SDA_LOW();
+		_delay_us(I2C_HALF_CLOCK_US);
+		I2C_SCL_RELEASE();
+		_delay_us(I2C_HALF_CLOCK_US);
+		I2C_SDA_RELEASE();
+		_delay_us(I2C_HALF_CLOCK_US);
+	}
+
+	I2C_statusReg.all = 0;
+	I2C_state = I2C_BUS_ERROR;
+	I2C_checkBusyAfterStop = 0;
+	TWCR = (1 << TWEN) |							   // Enable TWI-interface and release TWI pins.
+		   (0 << TWIE) | (0 << TWINT) |				   // Disable Interrupt.
+		   (0 << TWEA) | (0 << TWSTA) | (0 << TWSTO) | // No Signal requests.
+		   (0 << TWWC);
+
+	return ((~(I2C_PORT_STATUS) & (I2C_BIT_SCL | I2C_BIT_SDA)) == 0);
+}
+
 /****************************************************************************
 Call this function to fetch the state information of the previous operation. The function will hold execution (loop)
 until the TWI_ISR has completed with the previous operation. If there was an error, then the function
@@ -290,15 +445,27 @@ ISR(TWI_vect)
 	switch (TWSR)
 	{
 
-	case I2C_START:		// START has been transmitted
 	case I2C_REP_START: // Repeated START has been transmitted
-		I2C_bufPtr = 0; // Set buffer pointer to the TWI Address location
+		if (I2C_rdPhase)	// Turnaround of a combined transaction: send SLA+R of the read phase.
+		{
+			I2C_bufPtr = I2C_wrSize;
+			TWDR = I2C_buf[I2C_bufPtr++];
+			TWCR = (1 << TWEN) |							   // TWI Interface enabled
+				   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag to send byte
+				   (0 << TWEA) | (0 << TWSTA) | (0 << TWSTO) | //
+				   (0 << TWWC);								   //
+			break;
+		}
+
+	case I2C_START:			 // START has been transmitted
+		I2C_bufPtr = 0;		 // Set buffer pointer to the TWI Address location
+		I2C_rdPhase = false; // (Re)starting from the write phase.
 
 		// Master Transmitter
 
 	case I2C_MTX_ADR_ACK:  // SLA+W has been transmitted and ACK received
 	case I2C_MTX_DATA_ACK: // Data byte has been transmitted and ACK received
-		if (I2C_bufPtr < I2C_msgSize)
+		if (I2C_bufPtr < I2C_wrSize)
 		{
 			TWDR = I2C_buf[I2C_bufPtr++];
 			TWCR = (1 << TWEN) |							   // TWI Interface enabled
@@ -306,6 +473,14 @@ ISR(TWI_vect)
 				   (0 << TWEA) | (0 << TWSTA) | (0 << TWSTO) | //
 				   (0 << TWWC);								   //
 		}
+		else if (I2C_wrSize < I2C_msgSize) // Write phase done, turn the bus around for the read phase.
+		{
+			I2C_rdPhase = true;
+			TWCR = (1 << TWEN) |							   // TWI Interface enabled
+				   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag
+				   (0 << TWEA) | (1 << TWSTA) | (0 << TWSTO) | // Initiate a repeated START condition.
+				   (0 << TWWC);								   //
+		}
 		else // Send STOP after last byte
 		{
 			I2C_statusReg.lastTransOK = true;				   // Set status bits to completed successfully.
@@ -316,14 +491,29 @@ ISR(TWI_vect)
 		}
 		break;
 
-	case I2C_MTX_ADR_NACK:								   // SLA+W has been transmitted and NACK received
-	case I2C_MTX_DATA_NACK:								   // Data byte has been transmitted and NACK received
-		I2C_state = TWSR;								   // Store TWSR and automatically sets clears noErrors bit.
-														   // Reset TWI Interface and send START.
-		TWCR = (1 << TWEN) |							   // Enable TWI-interface and release TWI pins
-			   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag
-			   (1 << TWEA) | (1 << TWSTA) | (0 << TWSTO) | // Send Start.
-			   (0 << TWWC);
+	case I2C_MTX_ADR_NACK:  // SLA+W has been transmitted and NACK received
+	case I2C_MTX_DATA_NACK: // Data byte has been transmitted and NACK received
+	case I2C_MRX_ADR_NACK:  // SLA+R has been transmitted and NACK received
+		I2C_state = TWSR;	// Store TWSR and automatically sets clears noErrors bit.
+		I2C_rdPhase = false; // Retry from the write phase.
+		if (I2C_curStats)
+			I2C_curStats->nacks++;
+
+		if (--I2C_retries)
+		{
+			// Reset TWI Interface and send START.
+			TWCR = (1 << TWEN) |							   // Enable TWI-interface and release TWI pins
+				   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag
+				   (1 << TWEA) | (1 << TWSTA) | (0 << TWSTO) | // Send Start.
+				   (0 << TWWC);
+		}
+		else // Give up, the slave is not there.
+		{
+			TWCR = (1 << TWEN) |							   // Enable TWI-interface and release TWI pins
+				   (0 << TWIE) | (1 << TWINT) |				   // Disable TWI Interrupt and clear the flag
+				   (1 << TWEA) | (0 << TWSTA) | (1 << TWSTO) | // Send stop.
+				   (0 << TWWC);
+		}
 		break;
 
 		// Master Receiver
@@ -357,15 +547,6 @@ ISR(TWI_vect)
 			   (0 << TWWC);								   //
 		break;
 
-	case I2C_MRX_ADR_NACK: // SLA+R has been transmitted and NACK received
-		I2C_state = TWSR;  // Store TWSR and automatically sets clears noErrors bit.
-		// Reset TWI Interface and send STOP.
-		TWCR = (1 << TWEN) |							   // Enable TWI-interface and release TWI pins
-			   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag
-			   (1 << TWEA) | (0 << TWSTA) | (1 << TWSTO) | // Send stop.
-			   (0 << TWWC);
-		break;
-
 		// Slave Transmitter
 
 	case I2C_STX_ADR_ACK:			 // Own SLA+R has been received; ACK has been returned
@@ -474,22 +655,40 @@ ISR(TWI_vect)
 
 		// ERRORS AND FAULT CONDITIONS
 
-	case I2C_ARB_LOST:									   // Arbitration lost
-		TWCR = (1 << TWEN) |							   // TWI Interface enabled
-			   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag
-			   (1 << TWEA) | (1 << TWSTA) | (0 << TWSTO) | // Initiate a (RE)START condition.
-			   (0 << TWWC);								   //
+	case I2C_ARB_LOST: // Arbitration lost
+		if (I2C_curStats)
+			I2C_curStats->arbLost++;
+
+		if (--I2C_retries)
+		{
+			TWCR = (1 << TWEN) |							   // TWI Interface enabled
+				   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag
+				   (1 << TWEA) | (1 << TWSTA) | (0 << TWSTO) | // Initiate a (RE)START condition.
+				   (0 << TWWC);								   //
+		}
+		else // Give up, leave the bus to the other master.
+		{
+			I2C_state = TWSR;
+			TWCR = (1 << TWEN) |							   // TWI Interface enabled
+				   (0 << TWIE) | (1 << TWINT) |				   // Disable TWI Interrupt and clear the flag
+				   (1 << TWEA) | (0 << TWSTA) | (0 << TWSTO) | // Release the bus.
+				   (0 << TWWC);								   //
+		}
 		break;
 
 	case I2C_BUS_ERROR: // Bus error due to an illegal START or STOP condition
-	case I2C_NO_STATE:	// No relevant state information available TWINT = 0
+		if (I2C_curStats)
+			I2C_curStats->busErrors++;
+		// fall through
+	case I2C_NO_STATE: // No relevant state information available TWINT = 0
 
 	default:
 		I2C_state = TWSR; // Store TWSR and automatically sets clears noErrors bit.
 
-		// Reset TWI Interface
+		// Reset TWI Interface. The transaction ends here with an error,
+		// a STOP does not raise TWINT again so the interrupt is disabled.
 		TWCR = (1 << TWEN) |							   // Enable TWI-interface and release TWI pins
-			   (1 << TWIE) | (1 << TWINT) |				   // Enable TWI Interrupt and clear the flag
+			   (0 << TWIE) | (1 << TWINT) |				   // Disable TWI Interrupt and clear the flag
 			   (1 << TWEA) | (0 << TWSTA) | (1 << TWSTO) | // Acknowledge on any new requests. Send stop.
 			   (0 << TWWC);								   //
 		break;
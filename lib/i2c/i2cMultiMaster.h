@@ -36,6 +36,35 @@ extern "C"
 /* A value of 0 turns off this feature. Greater values are slower but more reliable. Try 4 */
 #define I2C_HOW_MANY_BUSY_CHECKS_AFTER_STOP 4
 
+/* Latency bounds. Nothing in the driver waits on the bus longer than these.
+   The busy-wait loops poll the transceiver every I2C_POLL_US and measure the deadlines against
+   xTaskGetTickCount(), so the time spent in interrupts counts too. When a deadline expires the
+   transfer is aborted and the event is counted. If a slave still holds SDA low once the bus had
+   I2C_STRETCH_ALLOWANCE_US to settle, the bus is recovered by clocking SCL and sending a STOP. */
+#define I2C_POLL_US 10                                  // Polling interval of the busy-wait loops.
+#define I2C_BYTE_TIME_US ((9 * 1000000UL) / SCL_CLOCK) // One byte plus ACK at SCL_CLOCK (90us at 100kHz).
+#define I2C_STRETCH_ALLOWANCE_US 1000                   // Clock stretching, arbitration and retries.
+#define I2C_BUS_FREE_TIMEOUT_US 1000                    // Longest wait for another master to release the bus.
+#define I2C_MAX_RETRIES 3                               // START attempts after NACK or lost arbitration.
+#define I2C_SEMAPHORE_TIMEOUT ((TickType_t)10)          // Ticks to wait for the xI2CSemaphore.
+
+/* Deadline of one transaction of msgSize bytes (address bytes included), every retry included. */
+#define I2C_TRANSACTION_TIMEOUT_US(msgSize) (I2C_MAX_RETRIES * (msgSize) * I2C_BYTE_TIME_US + I2C_STRETCH_ALLOWANCE_US)
+
+/* Bus recovery: wait for SDA to be released, then up to 9 SCL clocks to free it and a STOP. */
+#define I2C_RECOVERY_US (I2C_STRETCH_ALLOWANCE_US + 11 * 1000000UL / SCL_CLOCK)
+
+/* Deadline in RTOS ticks. Rounded up, plus one because the first tick may come at once. */
+#define I2C_US_TO_TICKS(us) ((TickType_t)((((uint32_t)(us) * configTICK_RATE_HZ) + 999999UL) / 1000000UL) + 1)
+
+/* Worst case time I2C_Master_Transfer() keeps the calling task, once it holds the xI2CSemaphore:
+   bus free wait + transaction deadline + bus recovery, each rounded up by I2C_US_TO_TICKS(). */
+#define I2C_WORST_CASE_US(msgSize) (I2C_BUS_FREE_TIMEOUT_US + I2C_TRANSACTION_TIMEOUT_US(msgSize) + I2C_RECOVERY_US + \
+                                    3 * 2 * (1000000UL / configTICK_RATE_HZ))
+
+/* Number of slave addresses that get their own error statistics. */
+#define I2C_STATS_DEVICES 4
+
   /****************************************************************************
     Global definitions
   ****************************************************************************/
@@ -54,9 +83,45 @@ extern "C"
 
   extern union I2C_statusReg I2C_statusReg; // DEFINED THIS IN THE LIBRARY.
 
+  /****************************************************************************
+    Master transaction descriptor.
+    The write phase sends the command or register pointer bytes, then a repeated START turns the
+    bus around and the read phase collects the answer, all under a single START ... STOP frame.
+    Either phase may be empty: txSize = 0 is a plain read, rxSize = 0 is a plain write.
+    txSize + rxSize + 2 (both address bytes) must fit in I2C_BUFFER_SIZE, I2C_Master_Transfer()
+    refuses larger ones.
+  ****************************************************************************/
+  typedef struct
+  {
+    uint8_t address; // Slave address with the R/W bit clear, e.g. DS1307 (0xD0).
+    uint8_t *txData; // Bytes sent in the write phase (command, register pointer, data).
+    uint8_t txSize;  // Number of bytes in the write phase, not counting the address byte.
+    uint8_t *rxData; // Destination of the bytes received in the read phase.
+    uint8_t rxSize;  // Number of bytes in the read phase, not counting the address byte.
+  } I2C_Transaction_t;
+
   /* Create a Semaphore binary flag for the i2c Bus. To ensure only single access. */
   extern SemaphoreHandle_t xI2CSemaphore;
 
+  /****************************************************************************
+    Error statistics, kept per slave address by I2C_Master_Transfer().
+  ****************************************************************************/
+  typedef struct
+  {
+    uint8_t address;        // Slave address with the R/W bit clear, 0 = unused slot.
+    uint16_t transfers;     // Transactions completed successfully.
+    uint16_t nacks;         // Address or data byte not acknowledged.
+    uint16_t arbLost;       // Arbitration lost to another master.
+    uint16_t busErrors;     // Illegal START or STOP seen on the bus.
+    uint16_t timeouts;      // Deadline expired, transfer aborted and bus recovered.
+    uint16_t lockTimeouts;  // xI2CSemaphore not obtained within I2C_SEMAPHORE_TIMEOUT.
+    uint16_t oversized;     // txSize + rxSize + 2 larger than I2C_BUFFER_SIZE, refused before the START.
+    uint16_t maxLatency_us; // Longest transaction seen in us, to the resolution of one RTOS tick.
+  } I2C_DeviceStats_t;
+
+  extern I2C_DeviceStats_t I2C_deviceStats[I2C_STATS_DEVICES];
+  extern I2C_DeviceStats_t *volatile I2C_curStats; // Statistics of the transaction in progress, updated by the ISR.
+
   /****************************************************************************
     Function definitions
   ****************************************************************************/
@@ -70,8 +135,18 @@ extern "C"
   void I2C_Master_Start_Transceiver_With_Data(uint8_t *, uint8_t);
   uint8_t I2C_Master_Get_Data_From_Transceiver(uint8_t *, uint8_t);
 
+  void I2C_Master_Start_Transaction(const I2C_Transaction_t *);
+  uint8_t I2C_Master_Get_Data_From_Transaction(const I2C_Transaction_t *);
+
   uint8_t I2C_Check_Free_After_Stop(void);
   uint8_t I2C_Get_State_Info(void);
+  uint8_t I2C_Transceiver_Busy(void) __attribute__((flatten));
+
+  uint8_t I2C_Master_Transfer(const I2C_Transaction_t *);
+  uint8_t I2C_Bus_Recover(void);
+
+  I2C_DeviceStats_t *I2C_Get_Device_Stats(uint8_t);
+  void I2C_Clear_Device_Stats(void);
 
 /****************************************************************************
   Bit and byte definitions
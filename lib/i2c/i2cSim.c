@@ -0,0 +1,341 @@
+/*****************************************************************************
+ *
+ * File              : i2cSim.c
+ * Compiler          : host gcc
+ * Description       : Simulated TWI module for host builds. It defines the TWI and
+ *                     port D registers that i2cMultiMaster.c uses in place of the
+ *                     hardware, and runs every operation the driver starts by
+ *                     writing TWINT to TWCR: START, address or data byte, STOP.
+ *                     Each takes its bus time at SCL_CLOCK, then TWSR gets the
+ *                     status code and the driver's ISR is called, as the TWI
+ *                     interrupt would. Time passes when the driver busy-waits
+ *                     (_delay_us() of the host stubs).
+ *
+ ****************************************************************************/
+
+#if !defined(__AVR__)
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+/* Scheduler include files. */
+#include "FreeRTOS.h"
+
+#include "i2cSim.h"
+
+#define I2C_BIT_TIME_US (1000000UL / SCL_CLOCK) // START, repeated START or STOP.
+
+/* The registers of the TWI module, and of port D which carries SCL and SDA. */
+volatile uint8_t TWBR;
+volatile uint8_t TWCR;
+volatile uint8_t TWSR = I2C_NO_STATE;
+volatile uint8_t TWDR;
+volatile uint8_t TWAR;
+volatile uint8_t PORTD;
+volatile uint8_t DDRD;
+volatile uint8_t PIND = I2C_BIT_SCL | I2C_BIT_SDA;
+
+void TWI_vect(void); // ISR of i2cMultiMaster.c
+
+static I2C_SimDevice_t *I2C_simDevices[I2C_SIM_MAX_DEVICES];
+static I2C_SimDevice_t *I2C_simDev; // Device addressed in the frame in progress.
+static uint32_t I2C_simStart;		// ulHostTime_us() at I2C_Sim_Reset().
+static uint32_t I2C_simLast;		// Simulated time the TWI module has caught up to.
+static uint32_t I2C_simDone;		// End of the operation in progress.
+static uint8_t I2C_simCmd;			// TWCR that started the operation in progress, 0 = idle.
+static uint8_t I2C_simHung;			// The operation in progress never ends, SDA is held low.
+static uint8_t I2C_simOwner;		// START sent, the bus is ours until the STOP.
+static uint8_t I2C_simAddress;		// The next byte sent is an address byte.
+static uint8_t I2C_simReading;		// The frame in progress reads from the slave.
+static uint8_t I2C_simScl;			// SCL level at the last step, to count the recovery clocks.
+static uint8_t I2C_simStuck;		// SCL pulses the slave still needs to release SDA.
+static uint8_t I2C_simArbLost;
+static uint8_t I2C_simBusErrors;
+static uint16_t I2C_simRecoveries;
+static uint16_t I2C_simClocks;
+
+/* Private Functions */
+
+static void I2C_Sim_Step(void);
+
+/****************************************************************************
+ Bus control
+****************************************************************************/
+void I2C_Sim_Reset(void)
+{
+	memset(I2C_simDevices, 0, sizeof(I2C_simDevices));
+	memset(I2C_deviceStats, 0, sizeof(I2C_deviceStats));
+	TWCR = 0;
+	TWSR = I2C_NO_STATE;
+	PORTD = 0;
+	DDRD = 0;
+	PIND = I2C_BIT_SCL | I2C_BIT_SDA;
+	I2C_simDev = NULL;
+	I2C_simStart = ulHostTime_us();
+	I2C_simLast = I2C_simStart;
+	I2C_simCmd = 0;
+	I2C_simHung = false;
+	I2C_simOwner = false;
+	I2C_simScl = true;
+	I2C_simStuck = 0;
+	I2C_simArbLost = 0;
+	I2C_simBusErrors = 0;
+	I2C_simRecoveries = 0;
+	I2C_simClocks = 0;
+	vHostSetPeripheral(I2C_Sim_Step);
+}
+
+uint8_t I2C_Sim_Attach(I2C_SimDevice_t *dev)
+{
+	uint8_t i;
+
+	for (i = 0; i < I2C_SIM_MAX_DEVICES; i++)
+	{
+		if (I2C_simDevices[i] == NULL)
+		{
+			I2C_simDevices[i] = dev;
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t I2C_Sim_Time_us(void)
+{
+	return ulHostTime_us() - I2C_simStart;
+}
+
+uint16_t I2C_Sim_Recoveries(void)
+{
+	return I2C_simRecoveries;
+}
+
+uint16_t I2C_Sim_Clocks(void)
+{
+	return I2C_simClocks;
+}
+
+void I2C_Sim_Inject_Arb_Lost(uint8_t count)
+{
+	I2C_simArbLost = count;
+}
+
+void I2C_Sim_Inject_Bus_Error(uint8_t count)
+{
+	I2C_simBusErrors = count;
+}
+
+void I2C_Sim_Inject_Stuck_Bus(uint8_t clocks)
+{
+	I2C_simStuck = clocks;
+	PIND &= ~I2C_BIT_SDA;
+}
+
+/****************************************************************************
+ Device side of the bus
+****************************************************************************/
+static I2C_SimDevice_t *I2C_Sim_Find(uint8_t address)
+{
+	uint8_t i;
+
+	address &= ~(1 << I2C_READ_BIT);
+	for (i = 0; i < I2C_SIM_MAX_DEVICES; i++)
+		if (I2C_simDevices[i] && (I2C_simDevices[i]->address == address))
+			return I2C_simDevices[i];
+	return NULL;
+}
+
+// Address byte, returns the ACK of the device.
+static uint8_t I2C_Sim_Address(I2C_SimDevice_t *dev, uint8_t sla)
+{
+	if (dev == NULL)
+		return false;
+	if (dev->faults.nackAddress)
+	{
+		dev->faults.nackAddress--;
+		dev->count.nacks++;
+		return false;
+	}
+	dev->index = 0;
+	dev->count.starts++;
+	if (dev->start)
+		dev->start(dev, sla & (1 << I2C_READ_BIT));
+	return true;
+}
+
+// Written data byte, returns the ACK of the device.
+static uint8_t I2C_Sim_Write(I2C_SimDevice_t *dev, uint8_t data)
+{
+	if (dev->faults.nackData)
+	{
+		dev->faults.nackData--;
+		dev->count.nacks++;
+		return false;
+	}
+	dev->count.written++;
+	if (dev->write && !dev->write(dev, data))
+	{
+		dev->count.nacks++;
+		return false;
+	}
+	dev->index++;
+	return true;
+}
+
+static uint8_t I2C_Sim_Read(I2C_SimDevice_t *dev)
+{
+	uint8_t data;
+
+	dev->count.read++;
+	data = dev->read ? dev->read(dev) : 0xFF;
+	dev->index++;
+	return data;
+}
+
+/****************************************************************************
+ TWI module
+****************************************************************************/
+
+// Bus time of the operation cmd starts, with the clock stretching of the device.
+static uint32_t I2C_Sim_Duration(uint8_t cmd)
+{
+	I2C_SimDevice_t *dev;
+
+	if (cmd & ((1 << TWSTO) | (1 << TWSTA)))
+	{
+		if ((cmd & (1 << TWSTA)) && I2C_simStuck) // SDA is held low, the START never completes.
+			I2C_simHung = true;
+		return I2C_BIT_TIME_US;
+	}
+	if (!I2C_simOwner) // Bus released, nothing is sent.
+		return 0;
+
+	dev = I2C_simAddress ? I2C_Sim_Find(TWDR) : I2C_simDev;
+	if (dev == NULL)
+		return I2C_BYTE_TIME_US;
+	dev->count.stretch_us += dev->faults.stretch_us;
+	return I2C_BYTE_TIME_US + dev->faults.stretch_us;
+}
+
+// End of the operation in progress: TWSR and TWINT as the hardware sets them, then the ISR.
+static void I2C_Sim_Complete(void)
+{
+	uint8_t cmd = I2C_simCmd;
+	uint8_t status;
+
+	I2C_simCmd = 0;
+
+	if (cmd & (1 << TWSTO))
+	{
+		if (I2C_simDev && I2C_simDev->stop)
+			I2C_simDev->stop(I2C_simDev);
+		I2C_simDev = NULL;
+		I2C_simOwner = false;
+		TWCR &= ~(1 << TWSTO); // A STOP does not set TWINT.
+		return;
+	}
+
+	if (cmd & (1 << TWSTA))
+	{
+		if (I2C_simBusErrors)
+		{
+			I2C_simBusErrors--;
+			I2C_simOwner = false;
+			status = I2C_BUS_ERROR;
+		}
+		else if (I2C_simArbLost)
+		{
+			I2C_simArbLost--;
+			I2C_simOwner = false;
+			status = I2C_ARB_LOST;
+		}
+		else
+		{
+			status = I2C_simOwner ? I2C_REP_START : I2C_START;
+			I2C_simOwner = true;
+			I2C_simAddress = true;
+		}
+	}
+	else if (!I2C_simOwner)
+		return;
+	else if (I2C_simAddress)
+	{
+		I2C_simAddress = false;
+		I2C_simReading = TWDR & (1 << I2C_READ_BIT);
+		I2C_simDev = I2C_Sim_Find(TWDR);
+		if (I2C_Sim_Address(I2C_simDev, TWDR))
+			status = I2C_simReading ? I2C_MRX_ADR_ACK : I2C_MTX_ADR_ACK;
+		else
+			status = I2C_simReading ? I2C_MRX_ADR_NACK : I2C_MTX_ADR_NACK;
+	}
+	else if (!I2C_simReading)
+		status = I2C_Sim_Write(I2C_simDev, TWDR) ? I2C_MTX_DATA_ACK : I2C_MTX_DATA_NACK;
+	else
+	{
+		TWDR = I2C_Sim_Read(I2C_simDev);
+		status = (cmd & (1 << TWEA)) ? I2C_MRX_DATA_ACK : I2C_MRX_DATA_NACK;
+	}
+
+	TWSR = status;
+	TWCR |= (1 << TWINT);
+	if (TWCR & (1 << TWIE))
+		TWI_vect();
+}
+
+// With the TWI module off SCL and SDA are port pins. A slave holding SDA lets go after enough SCL pulses.
+static void I2C_Sim_Lines(void)
+{
+	uint8_t scl = !((DDRD & I2C_BIT_SCL) && !(PORTD & I2C_BIT_SCL));
+	uint8_t sda = !((DDRD & I2C_BIT_SDA) && !(PORTD & I2C_BIT_SDA));
+
+	if (!(TWCR & (1 << TWEN)))
+	{
+		if (scl && !I2C_simScl) // SCL pulse driven by hand.
+		{
+			I2C_simClocks++;
+			if (I2C_simStuck && (--I2C_simStuck == 0))
+				I2C_simRecoveries++;
+		}
+		I2C_simScl = scl;
+	}
+	if (I2C_simStuck)
+		sda = false;
+	PIND = (PIND & ~(I2C_BIT_SCL | I2C_BIT_SDA)) | (scl ? I2C_BIT_SCL : 0) | (sda ? I2C_BIT_SDA : 0);
+}
+
+// Catch up with the simulated time, called by the host stubs whenever it passes.
+static void I2C_Sim_Step(void)
+{
+	uint32_t now = ulHostTime_us();
+
+	I2C_Sim_Lines();
+
+	for (;;)
+	{
+		if (!(TWCR & (1 << TWEN))) // Module off, the operation in progress is lost.
+		{
+			I2C_simCmd = 0;
+			I2C_simHung = false;
+			I2C_simOwner = false;
+			I2C_simDev = NULL;
+			break;
+		}
+		if (I2C_simCmd == 0)
+		{
+			if (!(TWCR & (1 << TWINT))) // Nothing started.
+				break;
+			I2C_simCmd = TWCR;
+			TWCR &= ~(1 << TWINT); // Writing one clears the flag and starts the operation.
+			I2C_simDone = I2C_simLast + I2C_Sim_Duration(I2C_simCmd);
+		}
+		if (I2C_simHung || ((int32_t)(now - I2C_simDone) < 0))
+			break;
+		I2C_simLast = I2C_simDone;
+		I2C_Sim_Complete();
+	}
+	I2C_simLast = now;
+}
+
+#endif // !__AVR__
@@ -0,0 +1,90 @@
+/*****************************************************************************
+ *
+ * File              : i2cSim.h
+ * Compiler          : host gcc
+ * Description       : Simulated I2C bus for host builds (anything but __AVR__).
+ *                     i2cSim.c stands in for the TWI module: it owns the TWI and
+ *                     port D registers, runs the bus operations i2cMultiMaster.c
+ *                     writes to TWCR against device models and calls its ISR, so
+ *                     the unchanged driver, i2cTransfer.c and the RTC and DAC
+ *                     drivers run on a Linux machine. Bus time is simulated at
+ *                     SCL_CLOCK, faults can be injected per device or on the bus.
+ *
+ ****************************************************************************/
+#ifndef I2CSIM_H
+#define I2CSIM_H
+
+#include <stdint.h>
+
+#include "i2cMultiMaster.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define I2C_SIM_MAX_DEVICES 8
+
+  /****************************************************************************
+    Faults, consumed one by one as the bus runs into them.
+  ****************************************************************************/
+  typedef struct
+  {
+    uint8_t nackAddress;  // NACK the next n address bytes.
+    uint8_t nackData;     // NACK the next n written data bytes.
+    uint16_t stretch_us;  // Clock stretching added to every byte.
+  } I2C_SimFaults_t;
+
+  /****************************************************************************
+    Counters kept by the bus for every device.
+  ****************************************************************************/
+  typedef struct
+  {
+    uint16_t starts;     // Address byte acknowledged.
+    uint16_t nacks;      // Address or data bytes not acknowledged.
+    uint16_t written;    // Data bytes written to the device.
+    uint16_t read;       // Data bytes read from the device.
+    uint32_t stretch_us; // Total clock stretching.
+  } I2C_SimCounters_t;
+
+  typedef struct I2C_SimDevice
+  {
+    uint8_t address; // Slave address with the R/W bit clear.
+    void (*start)(struct I2C_SimDevice *, uint8_t read); // START or repeated START addressed to the device.
+    uint8_t (*write)(struct I2C_SimDevice *, uint8_t);   // Data byte written, return false to NACK it.
+    uint8_t (*read)(struct I2C_SimDevice *);             // Data byte read.
+    void (*stop)(struct I2C_SimDevice *);                // STOP.
+    uint8_t index;                                       // Data bytes since the last START, kept by the bus.
+    uint8_t pointer;                                     // Register pointer of the model.
+    uint8_t regs[64];                                    // Register or memory image of the model.
+    I2C_SimFaults_t faults;
+    I2C_SimCounters_t count;
+  } I2C_SimDevice_t;
+
+  /****************************************************************************
+    Bus control
+  ****************************************************************************/
+  void I2C_Sim_Reset(void);                  // Detach all devices, clear faults, counters, statistics and time.
+  uint8_t I2C_Sim_Attach(I2C_SimDevice_t *); // Connect a device model to the bus.
+  uint32_t I2C_Sim_Time_us(void);            // Simulated time since I2C_Sim_Reset().
+  uint16_t I2C_Sim_Recoveries(void);         // Stuck buses released by clocking SCL.
+  uint16_t I2C_Sim_Clocks(void);             // SCL pulses driven by hand, with the TWI module off.
+
+  void I2C_Sim_Inject_Arb_Lost(uint8_t count);   // Lose arbitration on the next count STARTs.
+  void I2C_Sim_Inject_Bus_Error(uint8_t count);  // Illegal START/STOP on the next count STARTs.
+  void I2C_Sim_Inject_Stuck_Bus(uint8_t clocks); // A slave holds SDA low until it sees clocks SCL pulses.
+
+  /****************************************************************************
+    Device models, in i2cSimDevices.c
+  ****************************************************************************/
+  void I2C_Sim_DS1307_Init(I2C_SimDevice_t *);
+  void I2C_Sim_DS1307_Tick(I2C_SimDevice_t *, uint32_t seconds); // Advance the clock registers.
+  void I2C_Sim_MCP4726_Init(I2C_SimDevice_t *);
+  uint16_t I2C_Sim_MCP4726_Output(I2C_SimDevice_t *); // Current 12 bit DAC value.
+  void I2C_Sim_MCP401x_Init(I2C_SimDevice_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* I2CSIM_H */
@@ -0,0 +1,185 @@
+/*****************************************************************************
+ *
+ * File              : i2cSimDevices.c
+ * Compiler          : host gcc
+ * Description       : Device models for the simulated I2C bus of i2cSim.c:
+ *                     DS1307 real time clock, MCP4726 DAC and MCP401x digital pot.
+ *                     Only the behaviour the drivers in lib/rtc and lib/dac rely on.
+ *
+ ****************************************************************************/
+
+#if !defined(__AVR__)
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "i2cSim.h"
+#include "rtc.h"
+#include "mcp4726.h"
+#include "mcp401x.h"
+
+/****************************************************************************
+ DS1307: 7 BCD time registers, control register and 56 bytes of RAM. The first
+ byte written sets the register pointer, which auto-increments and wraps at 64.
+****************************************************************************/
+static uint8_t DS1307_Write(I2C_SimDevice_t *dev, uint8_t data)
+{
+	if (dev->index == 0)
+		dev->pointer = data & 0x3F;
+	else
+	{
+		dev->regs[dev->pointer] = data;
+		dev->pointer = (dev->pointer + 1) & 0x3F;
+	}
+	return true;
+}
+
+static uint8_t DS1307_Read(I2C_SimDevice_t *dev)
+{
+	uint8_t data = dev->regs[dev->pointer];
+
+	dev->pointer = (dev->pointer + 1) & 0x3F;
+	return data;
+}
+
+void I2C_Sim_DS1307_Init(I2C_SimDevice_t *dev)
+{
+	memset(dev, 0, sizeof(I2C_SimDevice_t));
+	dev->address = DS1307;
+	dev->write = DS1307_Write;
+	dev->read = DS1307_Read;
+	dev->regs[3] = 0x01; // Sunday
+	dev->regs[4] = 0x01; // 1st
+	dev->regs[5] = 0x01; // January '00
+}
+
+static uint8_t bcdInc(uint8_t *reg, uint8_t mask, uint8_t first, uint8_t last)
+{
+	uint8_t val = (*reg & mask);
+
+	val = (val >> 4) * 10 + (val & 0x0F);
+	if (val >= last)
+		val = first;
+	else
+		val++;
+	*reg = (*reg & ~mask) | (uint8_t)(((val / 10) << 4) | (val % 10));
+	return (val == first); // carry
+}
+
+void I2C_Sim_DS1307_Tick(I2C_SimDevice_t *dev, uint32_t seconds)
+{
+	static const uint8_t daysInMonth[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	uint8_t month, year, days;
+
+	while (seconds--)
+	{
+		if (dev->regs[0] & 0x80) // CH bit, oscillator halted.
+			return;
+		if (!bcdInc(&dev->regs[0], 0x7F, 0, 59) || !bcdInc(&dev->regs[1], 0x7F, 0, 59) ||
+			!bcdInc(&dev->regs[2], 0x3F, 0, 23)) // 24 hour mode only
+			continue;
+
+		bcdInc(&dev->regs[3], 0x07, 1, 7);
+		month = (dev->regs[5] >> 4) * 10 + (dev->regs[5] & 0x0F);
+		year = (dev->regs[6] >> 4) * 10 + (dev->regs[6] & 0x0F);
+		days = daysInMonth[month - 1] + ((month == 2) && ((year & 3) == 0));
+		if (bcdInc(&dev->regs[4], 0x3F, 1, days) && bcdInc(&dev->regs[5], 0x1F, 1, 12))
+			bcdInc(&dev->regs[6], 0xFF, 0, 99);
+	}
+}
+
+/****************************************************************************
+ MCP4726: volatile DAC register and configuration bits.
+ regs[0] configuration, regs[1..2] 12 bit DAC value, regs[3] high byte in transit.
+****************************************************************************/
+static uint8_t MCP4726_Write(I2C_SimDevice_t *dev, uint8_t data)
+{
+	uint16_t value;
+
+	if (dev->index == 0)
+	{
+		dev->pointer = data; // command byte
+		if ((data >> 6) == 0) // Fast mode: 0 0 PD1 PD0 D11..D8
+			dev->regs[3] = data & 0x0F;
+		else if ((data >> 5) == 0b010 || (data >> 5) == 0b011) // Write memory: C2 C1 C0 VREF1 VREF0 PD1 PD0 G
+			dev->regs[0] = data & 0x1F;
+		else if ((data >> 5) == 0b100) // Write configuration bits only
+			dev->regs[0] = data & 0x1F;
+		else
+			return false;
+		return true;
+	}
+
+	if ((dev->pointer >> 6) == 0) // Fast mode, second byte D7..D0
+	{
+		if (dev->index != 1)
+			return false;
+		value = ((uint16_t)dev->regs[3] << 8) | data;
+	}
+	else if (dev->index == 1) // D11..D4
+	{
+		dev->regs[3] = data;
+		return true;
+	}
+	else if (dev->index == 2) // D3..D0 x x x x
+		value = ((uint16_t)dev->regs[3] << 4) | (data >> 4);
+	else
+		return false;
+
+	dev->regs[1] = (uint8_t)(value >> 8);
+	dev->regs[2] = (uint8_t)value;
+	return true;
+}
+
+static uint8_t MCP4726_Read(I2C_SimDevice_t *dev)
+{
+	uint16_t value = I2C_Sim_MCP4726_Output(dev);
+
+	switch (dev->index % 3) // volatile image, then the same as the non-volatile image
+	{
+	case 0:
+		return 0x80 | (dev->regs[0] << 1); // RDY, configuration bits
+	case 1:
+		return (uint8_t)(value >> 4);
+	default:
+		return (uint8_t)(value << 4);
+	}
+}
+
+void I2C_Sim_MCP4726_Init(I2C_SimDevice_t *dev)
+{
+	memset(dev, 0, sizeof(I2C_SimDevice_t));
+	dev->address = MCP4726_I2C_ADDRESS;
+	dev->write = MCP4726_Write;
+	dev->read = MCP4726_Read;
+}
+
+uint16_t I2C_Sim_MCP4726_Output(I2C_SimDevice_t *dev)
+{
+	return ((uint16_t)dev->regs[1] << 8) | dev->regs[2];
+}
+
+/****************************************************************************
+ MCP401x: a single 7 bit wiper register, no command byte.
+****************************************************************************/
+static uint8_t MCP401x_Write(I2C_SimDevice_t *dev, uint8_t data)
+{
+	dev->regs[0] = data & 0x7F;
+	return true;
+}
+
+static uint8_t MCP401x_Read(I2C_SimDevice_t *dev)
+{
+	return dev->regs[0];
+}
+
+void I2C_Sim_MCP401x_Init(I2C_SimDevice_t *dev)
+{
+	memset(dev, 0, sizeof(I2C_SimDevice_t));
+	dev->address = MCP401x_I2C_ADDRESS;
+	dev->write = MCP401x_Write;
+	dev->read = MCP401x_Read;
+	dev->regs[0] = 0x3F; // mid-scale at power on
+}
+
+#endif // !__AVR__
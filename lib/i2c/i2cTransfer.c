@@ -0,0 +1,182 @@
+/*****************************************************************************
+ *
+ * File              : i2cTransfer.c
+ * Compiler          : avr gcc, host gcc
+ * Description       : Bounded-latency master transactions and per device error
+ *                     statistics, on top of the transceiver of i2cMultiMaster.c.
+ *                     Nothing here touches the TWI registers, so the same code runs
+ *                     on the target and against the simulated TWI of i2cSim.c.
+ *
+ ****************************************************************************/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <util/delay.h>
+
+/* Scheduler include files. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "i2cMultiMaster.h"
+
+I2C_DeviceStats_t I2C_deviceStats[I2C_STATS_DEVICES]; // I2C_deviceStats is defined in i2cMultiMaster.h
+I2C_DeviceStats_t *volatile I2C_curStats;			  // I2C_curStats is defined in i2cMultiMaster.h
+
+/* Private Functions */
+
+static uint8_t I2C_Wait_Transceiver(TickType_t timeout, TickType_t *elapsed);
+static I2C_DeviceStats_t *I2C_Find_Device_Stats(uint8_t address, uint8_t claim);
+
+/****************************************************************************
+Wait for the transceiver to finish, polling every I2C_POLL_US. Returns false if it is still busy
+timeout ticks after the call. The ticks spent are returned in elapsed.
+****************************************************************************/
+static uint8_t I2C_Wait_Transceiver(TickType_t timeout, TickType_t *elapsed)
+{
+	TickType_t start = xTaskGetTickCount();
+
+	while (I2C_Transceiver_Busy())
+	{
+		if ((TickType_t)(xTaskGetTickCount() - start) >= timeout)
+			return false;
+		_delay_us(I2C_POLL_US);
+	}
+	*elapsed = xTaskGetTickCount() - start;
+	return true;
+}
+
+/****************************************************************************
+Call this function to run a complete master transaction with bounded latency. It takes the
+xI2CSemaphore (waiting at most I2C_SEMAPHORE_TIMEOUT), waits for a free bus, runs the transaction
+and collects the read phase. Every wait has a deadline, see I2C_WORST_CASE_US(). On timeout the
+transfer is aborted and the bus recovered. A transaction that does not fit in I2C_BUFFER_SIZE is
+refused. Errors are counted in the statistics of the slave address.
+Returns true if the transaction completed successfully.
+****************************************************************************/
+uint8_t I2C_Master_Transfer(const I2C_Transaction_t *xfer)
+{
+	I2C_DeviceStats_t *stats;
+	TickType_t elapsed;
+	uint32_t latency_us;
+	uint16_t msgSize;
+	uint8_t result = false;
+
+	if ((xI2CSemaphore == NULL) || (xSemaphoreTake(xI2CSemaphore, I2C_SEMAPHORE_TIMEOUT) != pdTRUE))
+	{
+		// The slot is not claimed without the bus, only an address seen before is counted.
+		portENTER_CRITICAL();
+		stats = I2C_Find_Device_Stats(xfer->address, false);
+		if (stats)
+			stats->lockTimeouts++;
+		portEXIT_CRITICAL();
+		return false;
+	}
+
+	stats = I2C_Find_Device_Stats(xfer->address, true);
+	msgSize = (uint16_t)xfer->txSize + xfer->rxSize + 2;
+	I2C_curStats = stats;
+
+	if (msgSize > I2C_BUFFER_SIZE) // Would overrun I2C_buf, nothing goes on the bus.
+	{
+		if (stats)
+			stats->oversized++;
+	}
+	else if (I2C_Check_Free_After_Stop() == pdTRUE)
+	{
+		I2C_Master_Start_Transaction(xfer);
+
+		if (I2C_Wait_Transceiver(I2C_US_TO_TICKS(I2C_TRANSACTION_TIMEOUT_US(msgSize)), &elapsed))
+		{
+			result = I2C_Master_Get_Data_From_Transaction(xfer);
+			if (stats)
+			{
+				if (result)
+					stats->transfers++;
+				latency_us = (uint32_t)elapsed * (1000000UL / configTICK_RATE_HZ);
+				if (latency_us > 0xFFFF)
+					latency_us = 0xFFFF;
+				if (latency_us > stats->maxLatency_us)
+					stats->maxLatency_us = latency_us;
+			}
+		}
+		else // Deadline expired, the bus or the slave is stuck.
+		{
+			if (stats)
+				stats->timeouts++;
+			I2C_Bus_Recover();
+		}
+	}
+	else // Bus did not become free in time.
+	{
+		if (stats)
+			stats->timeouts++;
+		I2C_Bus_Recover();
+	}
+
+	I2C_curStats = NULL;
+	xSemaphoreGive(xI2CSemaphore);
+	return result;
+}
+
+/****************************************************************************
+Look up the statistics slot of a slave address, and assign a free slot on first use if claim is set.
+The caller holds the xI2CSemaphore when it claims, so two tasks never take the same free slot.
+****************************************************************************/
+static I2C_DeviceStats_t *I2C_Find_Device_Stats(uint8_t address, uint8_t claim)
+{
+	uint8_t i;
+
+	address &= ~(1 << I2C_READ_BIT);
+	for (i = 0; i < I2C_STATS_DEVICES; i++)
+	{
+		if (I2C_deviceStats[i].address == address)
+			return &I2C_deviceStats[i];
+		if (I2C_deviceStats[i].address == 0)
+		{
+			if (!claim)
+				return NULL;
+			I2C_deviceStats[i].address = address;
+			return &I2C_deviceStats[i];
+		}
+	}
+	return NULL;
+}
+
+/****************************************************************************
+Call this function to get the statistics slot of a slave address. A free slot is assigned on first
+use, under the xI2CSemaphore. Returns NULL if all I2C_STATS_DEVICES slots are taken by other
+addresses, or if the bus could not be taken to assign one.
+****************************************************************************/
+I2C_DeviceStats_t *I2C_Get_Device_Stats(uint8_t address)
+{
+	I2C_DeviceStats_t *stats;
+
+	if ((xI2CSemaphore == NULL) || (xSemaphoreTake(xI2CSemaphore, I2C_SEMAPHORE_TIMEOUT) != pdTRUE))
+	{
+		portENTER_CRITICAL();
+		stats = I2C_Find_Device_Stats(address, false);
+		portEXIT_CRITICAL();
+		return stats;
+	}
+	stats = I2C_Find_Device_Stats(address, true);
+	xSemaphoreGive(xI2CSemaphore);
+	return stats;
+}
+
+/****************************************************************************
+Call this function to clear all error statistics.
+****************************************************************************/
+void I2C_Clear_Device_Stats(void)
+{
+	uint8_t i;
+
+	portENTER_CRITICAL();
+	for (i = 0; i < I2C_STATS_DEVICES; i++)
+	{
+		uint8_t address = I2C_deviceStats[i].address;
+		memset(&I2C_deviceStats[i], 0, sizeof(I2C_DeviceStats_t));
+		I2C_deviceStats[i].address = address;
+	}
+	portEXIT_CRITICAL();
+}
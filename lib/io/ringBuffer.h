@@ -43,7 +43,13 @@
  *  Note that for each buffer, insertion and removal operations may occur at the same time (via
  *  a multi-threaded ISR based system) however the same kind of operation (two or more insertions
  *  or deletions) must not overlap. If there is possibility of two or more of the same kind of
- *  operating occurring at the same point in time, atomic (mutex) locking should be used.
+ *  operating occurring at the same point in time, atomic (mutex) locking should be used, as
+ *  serial.c does with the xTxMutex of each port around its Tx ring buffer writes.
+ *
+ *  The producer only ever writes the head index and the consumer only the tail index. Both are
+ *  single bytes, so each side reads the other's index atomically and no interrupt masking is needed.
+ *  The indices run freely and are masked on access, so the size must be a power of two of at most
+ *  128 bytes. \ref ringBuffer_InitBuffer() rounds other sizes down.
  *
  *  \section Sec_RingBuff_ExampleUsage Example Usage
  *  The following snippet is an example of how this module may be used within a typical
@@ -81,6 +87,8 @@
 #ifndef __RING_BUFFER_H__
 #define __RING_BUFFER_H__
 
+#include <string.h>
+
 #include "FreeRTOS.h"
 
 /* Enable C linkage for C++ Compilers: */
@@ -140,23 +148,25 @@ extern "C" {
  */
 typedef struct
 {
-	volatile uint16_t count;	/**< Number of bytes currently stored in the buffer. */
-	volatile uint8_t * in;		/**< Current storage location in the circular buffer. */
-	volatile uint8_t * out;		/**< Current retrieval location in the circular buffer. */
+	volatile uint8_t head;		/**< Free running insertion index, written only by the producer. */
+	volatile uint8_t tail;		/**< Free running retrieval index, written only by the consumer. */
+	uint8_t mask;				/**< Size of the buffer's underlying storage array minus one. */
 	uint8_t* start;				/**< Pointer to the start of the buffer's underlying storage array. */
-	uint8_t* end;				/**< Pointer to the end of the buffer's underlying storage array. */
-	uint16_t size;				/**< Size of the buffer's underlying storage array. */
 } ringBuffer_t, * ringBufferPtr_t;
 
+/** Largest storage array a ring buffer can use, as the 8 bit indices must tell full from empty. */
+#define RING_BUFFER_MAX_SIZE	128
+
 /************************* Inline Functions: *************************/
 
 /** Initializes a ring buffer ready for use. Buffers must be initialized via this function
  *  before any operations are called upon them. Already initialized buffers may be reset
- *  by re-initializing them using this function.
+ *  by re-initializing them using this function, while neither side is using them.
  *
  *  \param[out] buffer   Pointer to a ring buffer structure to initialize.
  *  \param[out] dataPtr  Pointer to a global array that will hold the data stored into the ring buffer.
- *  \param[out] size     Maximum number of bytes that can be stored in the underlying data array.
+ *  \param[out] size     Size of the underlying data array. It is rounded down to a power of two,
+ *                       at most \ref RING_BUFFER_MAX_SIZE.
  */
 inline void
 ringBuffer_InitBuffer(	ringBuffer_t* buffer,
@@ -164,17 +174,15 @@ ringBuffer_InitBuffer(	ringBuffer_t* buffer,
 						const uint16_t size) ATTR_NON_NULL_PTR_ARG(1) ATTR_NON_NULL_PTR_ARG(2) ATTR_ALWAYS_INLINE;
 
 
-/** Flushes the contents of a ring buffer.
+/** Flushes the contents of a ring buffer. Only the consumer may flush a buffer.
  *
  *  \param[out] buffer   Pointer to a ring buffer structure to flush out.
  */
 inline void
 ringBuffer_Flush(ringBuffer_t* const buffer) ATTR_NON_NULL_PTR_ARG(1) ATTR_ALWAYS_INLINE;
 
-/** Retrieves the current number of bytes stored in a particular buffer. This value is computed
- *  by entering an atomic lock on the buffer, so that the buffer cannot be modified while the
- *  computation takes place. This value should be cached when reading out the contents of the buffer,
- *  so that as small a time as possible is spent in an atomic lock.
+/** Retrieves the current number of bytes stored in a particular buffer. Each index is a single
+ *  byte, so both are read atomically without an interrupt lock.
  *
  *  \note The value returned by this function is guaranteed to only be the minimum number of bytes
  *        stored in the given buffer; this value may change as other threads write new data, thus
@@ -188,8 +196,7 @@ ringBuffer_Flush(ringBuffer_t* const buffer) ATTR_NON_NULL_PTR_ARG(1) ATTR_ALWAY
 inline uint16_t
 ringBuffer_GetCount(ringBuffer_t* const buffer) ATTR_WARN_UNUSED_RESULT ATTR_NON_NULL_PTR_ARG(1) ATTR_ALWAYS_INLINE;
 
-/** Retrieves the free space in a particular buffer. This value is computed by entering an atomic lock
- *  on the buffer, so that the buffer cannot be modified while the computation takes place.
+/** Retrieves the free space in a particular buffer.
  *
  *  \note The value returned by this function is guaranteed to only be the maximum number of bytes
  *        free in the given buffer; this value may change as other threads write new data, thus
@@ -203,22 +210,18 @@ ringBuffer_GetCount(ringBuffer_t* const buffer) ATTR_WARN_UNUSED_RESULT ATTR_NON
 inline uint16_t
 ringBuffer_GetFreeCount(ringBuffer_t* const buffer) ATTR_WARN_UNUSED_RESULT ATTR_NON_NULL_PTR_ARG(1) ATTR_ALWAYS_INLINE;
 
-/** Atomically determines if the specified ring buffer contains any data. This should
+/** Determines if the specified ring buffer contains any data. This should
  *  be tested before removing data from the buffer, to ensure that the buffer does not
  *  underflow.
  *
- *  If the data is to be removed in a loop, store the total number of bytes stored in the
- *  buffer (via a call to the \ref ringBuffer_GetCount() function) in a temporary variable
- *  to reduce the time spent in atomicity locks.
- *
  *  \param[in,out] buffer  Pointer to a ring buffer structure to insert into.
  *
- *  \return Boolean \c true if the buffer contains no free space, \c false otherwise.
+ *  \return Boolean \c true if the buffer contains no data, \c false otherwise.
  */
 inline uint8_t
 ringBuffer_IsEmpty(ringBuffer_t* const buffer) ATTR_WARN_UNUSED_RESULT ATTR_NON_NULL_PTR_ARG(1) ATTR_ALWAYS_INLINE;
 
-/** Atomically determines if the specified ring buffer contains any free space. This should
+/** Determines if the specified ring buffer contains any free space. This should
  *  be tested before storing data to the buffer, to ensure that no data is lost due to a
  *  buffer overrun.
  *
@@ -254,6 +257,53 @@ ringBuffer_Poke(ringBuffer_t* buffer, const uint8_t data) ATTR_NON_NULL_PTR_ARG(
 inline uint8_t
 ringBuffer_Pop(ringBuffer_t* buffer) ATTR_NON_NULL_PTR_ARG(1) ATTR_ALWAYS_INLINE;
 
+/** Inserts a block of bytes into the ring buffer. The data is copied in at most two contiguous
+ *  segments, up to the end of the underlying storage array and then from its start, and made
+ *  visible to the reader with a single update of the head index.
+ *
+ *  \warning Only one execution thread (main program thread or an ISR) may insert into a single buffer
+ *           otherwise data corruption may occur. Insertion and removal may occur from different execution
+ *           threads.
+ *
+ *  \param[in,out] buffer  Pointer to a ring buffer structure to insert into.
+ *  \param[in]     data    Pointer to the bytes to insert.
+ *  \param[in]     len     Number of bytes to insert.
+ *
+ *  \return Number of bytes inserted, less than \c len if the buffer filled up.
+ */
+inline uint16_t
+ringBuffer_Write(ringBuffer_t* buffer, const uint8_t* data, uint16_t len) ATTR_NON_NULL_PTR_ARG(1) ATTR_NON_NULL_PTR_ARG(2) ATTR_ALWAYS_INLINE;
+
+/** Removes a block of bytes from the ring buffer. The data is copied out in at most two contiguous
+ *  segments and the space is released with a single update of the tail index.
+ *
+ *  \warning Only one execution thread (main program thread or an ISR) may remove from a single buffer
+ *           otherwise data corruption may occur. Insertion and removal may occur from different execution
+ *           threads.
+ *
+ *  \param[in,out] buffer  Pointer to a ring buffer structure to retrieve from.
+ *  \param[out]    data    Pointer to the destination for the removed bytes.
+ *  \param[in]     len     Maximum number of bytes to remove.
+ *
+ *  \return Number of bytes removed, less than \c len if the buffer ran empty.
+ */
+inline uint16_t
+ringBuffer_Read(ringBuffer_t* buffer, uint8_t* data, uint16_t len) ATTR_NON_NULL_PTR_ARG(1) ATTR_NON_NULL_PTR_ARG(2) ATTR_ALWAYS_INLINE;
+
+/** Searches the first \c len stored bytes for a value, without removing anything. The data is
+ *  scanned in at most two contiguous segments, as \ref ringBuffer_Read() copies it.
+ *
+ *  \warning Only the thread removing from the buffer may search it.
+ *
+ *  \param[in] buffer  Pointer to a ring buffer structure to search.
+ *  \param[in] data    Value to look for.
+ *  \param[in] len     Number of stored bytes to search, at most the count.
+ *
+ *  \return Number of bytes up to and including the value, 0 if it is not among them.
+ */
+inline uint16_t
+ringBuffer_Find(ringBuffer_t* const buffer, const uint8_t data, uint16_t len) ATTR_WARN_UNUSED_RESULT ATTR_NON_NULL_PTR_ARG(1) ATTR_ALWAYS_INLINE;
+
 /** Returns the next element stored in the ring buffer, without removing it.
  *
  *  \param[in,out] buffer  Pointer to a ring buffer structure to retrieve from.
@@ -271,60 +321,45 @@ ringBuffer_InitBuffer(	ringBuffer_t* buffer,
 {
 	GCC_FORCE_POINTER_ACCESS(buffer);
 
-	portENTER_CRITICAL();
-	{
-    	buffer->count  = 0;
-    	buffer->in     = dataPtr;
-    	buffer->out    = dataPtr;
-    	buffer->start  = &dataPtr[0];
-    	buffer->end    = &dataPtr[size];
-    	buffer->size   = size;
-	}
-	portEXIT_CRITICAL();
+	uint16_t pow2 = RING_BUFFER_MAX_SIZE;
+
+	while (pow2 > size)
+	  pow2 >>= 1;
+
+	buffer->head   = 0;
+	buffer->tail   = 0;
+	buffer->mask   = (uint8_t)(pow2 - 1);
+	buffer->start  = dataPtr;
 }
 
 inline void
 ringBuffer_Flush(ringBuffer_t* const buffer)
 {
-	portENTER_CRITICAL();
-	{
-    	buffer->count	= 0;
-    	buffer->in		= buffer->start;
-    	buffer->out		= buffer->start;
-	}
-	portEXIT_CRITICAL();
+	buffer->tail = buffer->head;
 }
 
 inline uint16_t
 ringBuffer_GetCount(ringBuffer_t* const buffer)
 {
-	uint16_t count;
-
-	portENTER_CRITICAL();
-	{
-	    count = buffer->count;
-	}
-	portEXIT_CRITICAL();
-
-	return count;
+	return (uint8_t)(buffer->head - buffer->tail);
 }
 
 inline uint16_t
 ringBuffer_GetFreeCount(ringBuffer_t* const buffer)
 {
-	return (buffer->size - ringBuffer_GetCount(buffer));
+	return (buffer->mask + 1 - ringBuffer_GetCount(buffer));
 }
 
 inline uint8_t
 ringBuffer_IsEmpty(ringBuffer_t* const buffer)
 {
-	return (ringBuffer_GetCount(buffer) == 0);
+	return (buffer->head == buffer->tail);
 }
 
 inline uint8_t
 ringBuffer_IsFull(ringBuffer_t* const buffer)
 {
-	return (ringBuffer_GetCount(buffer) == buffer->size);
+	return (ringBuffer_GetCount(buffer) > buffer->mask);
 }
 
 inline void
@@ -332,16 +367,11 @@ ringBuffer_Poke(ringBuffer_t* buffer, uint8_t const data)
 {
 	GCC_FORCE_POINTER_ACCESS(buffer);
 
-	*buffer->in = data;
-
-	if (++buffer->in == buffer->end)
-	  buffer->in = buffer->start;
+	uint8_t head = buffer->head;
 
-	portENTER_CRITICAL();
-	{
-	    buffer->count++;
-	}
-	portEXIT_CRITICAL();
+	buffer->start[head & buffer->mask] = data;
+	GCC_MEMORY_BARRIER();
+	buffer->head = head + 1;
 }
 
 inline uint8_t
@@ -349,24 +379,88 @@ ringBuffer_Pop(ringBuffer_t* buffer)
 {
 	GCC_FORCE_POINTER_ACCESS(buffer);
 
-	uint8_t data = *buffer->out;
+	uint8_t tail = buffer->tail;
+	uint8_t data = buffer->start[tail & buffer->mask];
 
-	if (++buffer->out == buffer->end)
-	  buffer->out = buffer->start;
-
-	portENTER_CRITICAL();
-	{
-	    buffer->count--;
-	}
-	portEXIT_CRITICAL();
+	GCC_MEMORY_BARRIER();
+	buffer->tail = tail + 1;
 
 	return data;
 }
 
+inline uint16_t
+ringBuffer_Write(ringBuffer_t* buffer, const uint8_t* data, uint16_t len)
+{
+	GCC_FORCE_POINTER_ACCESS(buffer);
+
+	uint8_t head = buffer->head;
+	uint8_t index = head & buffer->mask;
+	uint16_t free = ringBuffer_GetFreeCount(buffer);
+	uint16_t first;
+
+	if (len > free)
+	  len = free;
+
+	first = buffer->mask + 1 - index;
+	if (first > len)
+	  first = len;
+
+	memcpy(&buffer->start[index], data, first);
+	memcpy(buffer->start, data + first, len - first);
+
+	GCC_MEMORY_BARRIER();
+	buffer->head = head + (uint8_t)len;
+
+	return len;
+}
+
+inline uint16_t
+ringBuffer_Read(ringBuffer_t* buffer, uint8_t* data, uint16_t len)
+{
+	GCC_FORCE_POINTER_ACCESS(buffer);
+
+	uint8_t tail = buffer->tail;
+	uint8_t index = tail & buffer->mask;
+	uint16_t count = ringBuffer_GetCount(buffer);
+	uint16_t first;
+
+	if (len > count)
+	  len = count;
+
+	first = buffer->mask + 1 - index;
+	if (first > len)
+	  first = len;
+
+	memcpy(data, &buffer->start[index], first);
+	memcpy(data + first, buffer->start, len - first);
+
+	GCC_MEMORY_BARRIER();
+	buffer->tail = tail + (uint8_t)len;
+
+	return len;
+}
+
+inline uint16_t
+ringBuffer_Find(ringBuffer_t* const buffer, const uint8_t data, uint16_t len)
+{
+	uint8_t index = buffer->tail & buffer->mask;
+	uint16_t first = buffer->mask + 1 - index;
+	const uint8_t* found;
+
+	if (first > len)
+	  first = len;
+
+	if ((found = memchr(&buffer->start[index], data, first)) != NULL)
+	  return found - &buffer->start[index] + 1;
+	if ((found = memchr(buffer->start, data, len - first)) != NULL)
+	  return first + (found - buffer->start) + 1;
+	return 0;
+}
+
 inline uint8_t
 ringBuffer_Peek(ringBuffer_t* const buffer)
 {
-	return *buffer->out;
+	return buffer->start[buffer->tail & buffer->mask];
 }
 
 /* Disable C linkage for C++ Compilers: */
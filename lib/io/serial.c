@@ -69,12 +69,19 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
+#include "semphr.h"
 
 #include "ringBuffer.h"
+#include "usart.h"
 
 #include "serial.h"
 /*-----------------------------------------------------------*/
 
+#ifndef portSERIAL_TX_TIMEOUT
+#define portSERIAL_TX_TIMEOUT pdMS_TO_TICKS(100) // longest a writer blocks on a full Tx ring buffer.
+#endif
+/*-----------------------------------------------------------*/
+
 #define vInterrupt0_On()       \
 	{                          \
 		uint8_t ucByte;        \
@@ -117,17 +124,181 @@ xComPortHandle xSerialPort;
 xComPortHandle xSerial1Port;
 /*-----------------------------------------------------------------*/
 
+// Take the port's output lock. The mutex lends its priority to a lower priority holder.
+static void prvSerialLock(xComPortHandlePtr pxPort)
+{
+	if (pxPort->xTxMutex != NULL)
+		xSemaphoreTake(pxPort->xTxMutex, portMAX_DELAY);
+}
+
+static void prvSerialUnlock(xComPortHandlePtr pxPort)
+{
+	if (pxPort->xTxMutex != NULL)
+		xSemaphoreGive(pxPort->xTxMutex);
+}
+
+// Enable the UDRE interrupt, which drains the Tx ring buffer.
+static void prvSerialTxOn(xComPortHandlePtr pxPort)
+{
+	switch (pxPort->usart)
+	{
+	case USART0:
+		vInterrupt0_On();
+		break;
+	case USART1:
+		vInterrupt1_On();
+		break;
+	case USART2:
+	case USART3:
+	default:
+		break;
+	}
+}
+
+// Buffer a received byte and count what is lost, pdFALSE if it was.
+// USART1 has its FE, DOR and UPE bits where USART0 has them.
+static inline UBaseType_t prvSerialRxByte(xComPortHandlePtr pxPort, uint8_t ucStatus, uint8_t cChar) __attribute__((always_inline));
+static inline UBaseType_t prvSerialRxByte(xComPortHandlePtr pxPort, uint8_t ucStatus, uint8_t cChar)
+{
+	if (ucStatus & ((1 << FE0) | (1 << DOR0) | (1 << UPE0)))
+	{
+		if (ucStatus & (1 << FE0))
+			pxPort->stats.frameErrors++;
+		if (ucStatus & (1 << DOR0))
+			pxPort->stats.overruns++;
+		if (ucStatus & (1 << UPE0))
+			pxPort->stats.parityErrors++;
+		return pdFALSE;
+	}
+	if (ringBuffer_IsFull(&(pxPort->xRxedChars)))
+	{
+		pxPort->stats.rxDrops++;
+		return pdFALSE;
+	}
+	ringBuffer_Poke(&(pxPort->xRxedChars), cChar);
+	if (ringBuffer_GetCount(&(pxPort->xRxedChars)) > pxPort->stats.rxHighWater)
+		pxPort->stats.rxHighWater = ringBuffer_GetCount(&(pxPort->xRxedChars));
+	return pdTRUE;
+}
+
+// Wake a task in xSerialReceiveFrame() once the byte just buffered completes its frame.
+static inline void prvSerialRxNotify(xComPortHandlePtr pxPort, uint8_t cChar, uint8_t *woken) __attribute__((always_inline));
+static inline void prvSerialRxNotify(xComPortHandlePtr pxPort, uint8_t cChar, uint8_t *woken)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+	if (pxPort->xRxWaiting == NULL)
+		return;
+	if (cChar != pxPort->rxDelimiter &&
+		ringBuffer_GetCount(&(pxPort->xRxedChars)) < pxPort->rxCount &&
+		!ringBuffer_IsFull(&(pxPort->xRxedChars)))
+		return;
+
+	vTaskNotifyGiveIndexedFromISR(pxPort->xRxWaiting, SERIAL_NOTIFY_INDEX, &xHigherPriorityTaskWoken);
+	pxPort->xRxWaiting = NULL;
+	if (xHigherPriorityTaskWoken != pdFALSE)
+		*woken = 1; // usart.c yields on the way out
+}
+
+// Handlers of the usart.c driver core, for a port attached by xSerialPortInitMinimal()
+
+static xComPortHandlePtr prvSerialPort(uint8_t port)
+{
+	return port ? &xSerial1Port : &xSerialPort;
+}
+
+static void prvSerialRx(uint8_t port, uint8_t ucStatus, uint8_t cChar, uint8_t *woken)
+{
+	xComPortHandlePtr pxPort = prvSerialPort(port);
+
+	/* If error bit set (Frame Error, Data Over Run, Parity), count it and store nothing */
+	if (prvSerialRxByte(pxPort, ucStatus, cChar))
+		prvSerialRxNotify(pxPort, cChar, woken);
+}
+
+static int16_t prvSerialUdre(uint8_t port, uint8_t *woken)
+{
+	xComPortHandlePtr pxPort = prvSerialPort(port);
+	uint8_t cChar;
+
+	if (ringBuffer_IsEmpty(&(pxPort->xCharsForTx)))
+		return -1; // Queue empty, nothing to send.
+
+	cChar = ringBuffer_Pop(&(pxPort->xCharsForTx));
+
+	if (pxPort->xTxWaiting != NULL)
+	{
+		// A writer is blocked on the full ring, there is room for it now.
+		BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+		vTaskNotifyGiveIndexedFromISR(pxPort->xTxWaiting, SERIAL_NOTIFY_INDEX, &xHigherPriorityTaskWoken);
+		pxPort->xTxWaiting = NULL;
+		if (xHigherPriorityTaskWoken != pdFALSE)
+			*woken = 1; // usart.c yields once cChar is in UDRn, ahead of the woken writer's bytes
+	}
+	return cChar;
+}
+
+static const __flash usartHandler_t xSerialUsart = {prvSerialRx, prvSerialUdre, NULL};
+
+// Wait for room in a full Tx ring buffer. Return pdFAIL if none appeared within portSERIAL_TX_TIMEOUT.
+static UBaseType_t prvSerialTxWait(xComPortHandlePtr pxPort)
+{
+	// Before the scheduler starts interrupts are off and nothing drains the ring.
+	if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)
+		return pdFAIL;
+
+	// Sleep until the UDRE interrupt has popped a byte, rather than spinning.
+	// Register first, then test again: a pop in between leaves the notification pending.
+	portENTER_CRITICAL();
+	pxPort->xTxWaiting = xTaskGetCurrentTaskHandle();
+	portEXIT_CRITICAL();
+
+	while (ringBuffer_IsFull(&(pxPort->xCharsForTx)))
+		if (ulTaskNotifyTakeIndexed(SERIAL_NOTIFY_INDEX, pdTRUE, portSERIAL_TX_TIMEOUT) == 0)
+			break;
+
+	portENTER_CRITICAL();
+	pxPort->xTxWaiting = NULL;
+	portEXIT_CRITICAL();
+	// A pop after the last take notified us again, drop it before the next wait.
+	xTaskNotifyStateClearIndexed(NULL, SERIAL_NOTIFY_INDEX);
+	ulTaskNotifyValueClearIndexed(NULL, SERIAL_NOTIFY_INDEX, 0xFFFFFFFFUL);
+
+	return ringBuffer_IsFull(&(pxPort->xCharsForTx)) ? pdFAIL : pdPASS;
+}
+
+// Copy a block into the Tx ring buffer, the caller holding the output lock.
+// This is the only producer of xCharsForTx, and the ring buffer takes one producer at a time:
+// a port without its mutex takes no output rather than letting two writers move the head.
+static uint16_t prvSerialWrite(xComPortHandlePtr pxPort, const uint8_t *buf, uint16_t len)
+{
+	uint16_t done = 0;
+
+	if (pxPort->xTxMutex == NULL)
+		return 0;
+
+	while (done < len)
+	{
+		if (ringBuffer_IsFull(&(pxPort->xCharsForTx)) && prvSerialTxWait(pxPort) == pdFAIL)
+			break; // if the Tx ring buffer remains full
+		done += ringBuffer_Write(&(pxPort->xCharsForTx), buf + done, len - done);
+		if (ringBuffer_GetCount(&(pxPort->xCharsForTx)) > pxPort->stats.txHighWater)
+			pxPort->stats.txHighWater = ringBuffer_GetCount(&(pxPort->xCharsForTx));
+		prvSerialTxOn(pxPort);
+	}
+	return done;
+}
+/*-----------------------------------------------------------------*/
+
 // xSerialPrintf_P(PSTR("\r\nMessage %u %u %u"), var1, var2, var2);
 void xSerialPrintf(const char *format, ...)
 {
 	va_list arg;
 	va_start(arg, format);
-	while (xSerialPort.serialWorkBufferInUse == ENGAGED)
-		taskYIELD();
-	xSerialPort.serialWorkBufferInUse = ENGAGED;
+	prvSerialLock(&xSerialPort);
 	vsnprintf((char *)(xSerialPort.serialWorkBuffer), xSerialPort.serialWorkBufferSize, (const char *)format, arg);
-	xSerialPrint((uint8_t *)(xSerialPort.serialWorkBuffer));
-	xSerialPort.serialWorkBufferInUse = VACANT;
+	prvSerialWrite(&xSerialPort, xSerialPort.serialWorkBuffer, strlen((char *)(xSerialPort.serialWorkBuffer)));
+	prvSerialUnlock(&xSerialPort);
 	va_end(arg);
 }
 
@@ -135,31 +306,21 @@ void xSerialPrintf_P(PGM_P format, ...)
 {
 	va_list arg;
 	va_start(arg, format);
-	while (xSerialPort.serialWorkBufferInUse == ENGAGED)
-		taskYIELD();
-	xSerialPort.serialWorkBufferInUse = ENGAGED;
+	prvSerialLock(&xSerialPort);
 	vsnprintf_P((char *)(xSerialPort.serialWorkBuffer), xSerialPort.serialWorkBufferSize, format, arg);
-	xSerialPrint((uint8_t *)(xSerialPort.serialWorkBuffer));
-	xSerialPort.serialWorkBufferInUse = VACANT;
+	prvSerialWrite(&xSerialPort, xSerialPort.serialWorkBuffer, strlen((char *)(xSerialPort.serialWorkBuffer)));
+	prvSerialUnlock(&xSerialPort);
 	va_end(arg);
 }
 
 void xSerialPrint(uint8_t *str)
 {
-	int16_t i = 0;
-	size_t stringlength;
-	stringlength = strlen((char *)str);
-	while (i < stringlength)
-		xSerialPutChar(&xSerialPort, str[i++]);
+	xSerialWrite(&xSerialPort, str, strlen((char *)str));
 }
 
 void xSerialPrint_P(PGM_P str)
 {
-	uint16_t i = 0;
-	size_t stringlength;
-	stringlength = strlen_P(str);
-	while (i < stringlength)
-		xSerialPutChar(&xSerialPort, pgm_read_byte(&str[i++]));
+	xSerialxPrint_P(&xSerialPort, str);
 }
 /*-----------------------------------------------------------*/
 
@@ -169,12 +330,10 @@ void xSerialxPrintf(xComPortHandlePtr pxPort, const char *format, ...)
 {
 	va_list arg;
 	va_start(arg, format);
-	while (pxPort->serialWorkBufferInUse == ENGAGED)
-		taskYIELD();
-	pxPort->serialWorkBufferInUse = ENGAGED;
+	prvSerialLock(pxPort);
 	vsnprintf((char *)(pxPort->serialWorkBuffer), pxPort->serialWorkBufferSize, (const char *)format, arg);
-	xSerialxPrint(pxPort, (uint8_t *)(pxPort->serialWorkBuffer));
-	pxPort->serialWorkBufferInUse = VACANT;
+	prvSerialWrite(pxPort, pxPort->serialWorkBuffer, strlen((char *)(pxPort->serialWorkBuffer)));
+	prvSerialUnlock(pxPort);
 	va_end(arg);
 }
 
@@ -182,31 +341,142 @@ void xSerialxPrintf_P(xComPortHandlePtr pxPort, PGM_P format, ...)
 {
 	va_list arg;
 	va_start(arg, format);
-	while (pxPort->serialWorkBufferInUse == ENGAGED)
-		taskYIELD();
-	pxPort->serialWorkBufferInUse = ENGAGED;
+	prvSerialLock(pxPort);
 	vsnprintf_P((char *)(pxPort->serialWorkBuffer), pxPort->serialWorkBufferSize, format, arg);
-	xSerialxPrint(pxPort, (uint8_t *)(pxPort->serialWorkBuffer));
-	pxPort->serialWorkBufferInUse = VACANT;
+	prvSerialWrite(pxPort, pxPort->serialWorkBuffer, strlen((char *)(pxPort->serialWorkBuffer)));
+	prvSerialUnlock(pxPort);
 	va_end(arg);
 }
 
 void xSerialxPrint(xComPortHandlePtr pxPort, uint8_t *str)
 {
-	int16_t i = 0;
-	size_t stringlength;
-	stringlength = strlen((char *)str);
-	while (i < stringlength)
-		xSerialPutChar(pxPort, str[i++]);
+	xSerialWrite(pxPort, str, strlen((char *)str));
 }
 
 void xSerialxPrint_P(xComPortHandlePtr pxPort, PGM_P str)
 {
-	uint16_t i = 0;
-	size_t stringlength;
-	stringlength = strlen_P(str);
-	while (i < stringlength)
-		xSerialPutChar(pxPort, pgm_read_byte(&str[i++]));
+	uint8_t chunk[16]; // flash strings are copied through RAM in chunks of this size
+	size_t stringlength = strlen_P(str);
+	uint16_t n;
+
+	prvSerialLock(pxPort);
+	while (stringlength)
+	{
+		n = stringlength < sizeof(chunk) ? stringlength : sizeof(chunk);
+		memcpy_P(chunk, str, n);
+		if (prvSerialWrite(pxPort, chunk, n) != n)
+			break;
+		str += n;
+		stringlength -= n;
+	}
+	prvSerialUnlock(pxPort);
+}
+
+uint16_t xSerialxPrintfBuffer(xComPortHandlePtr pxPort, char *buf, size_t size, const char *format, ...)
+{
+	va_list arg;
+	va_start(arg, format);
+	vsnprintf(buf, size, format, arg);
+	va_end(arg);
+	return xSerialWrite(pxPort, (uint8_t *)buf, strlen(buf));
+}
+
+uint16_t xSerialxPrintfBuffer_P(xComPortHandlePtr pxPort, char *buf, size_t size, PGM_P format, ...)
+{
+	va_list arg;
+	va_start(arg, format);
+	vsnprintf_P(buf, size, format, arg);
+	va_end(arg);
+	return xSerialWrite(pxPort, (uint8_t *)buf, strlen(buf));
+}
+
+uint16_t xSerialWrite(xComPortHandlePtr pxPort, const uint8_t *buf, uint16_t len)
+{
+	prvSerialLock(pxPort);
+	len = prvSerialWrite(pxPort, buf, len);
+	prvSerialUnlock(pxPort);
+	return len;
+}
+
+uint16_t xSerialRead(xComPortHandlePtr pxPort, uint8_t *buf, uint16_t len)
+{
+	return ringBuffer_Read(&(pxPort->xRxedChars), buf, len);
+}
+
+uint16_t xSerialReceiveFrame(xComPortHandlePtr pxPort, int16_t delimiter, uint16_t count, TickType_t idle, uint8_t **frame)
+{
+	uint16_t size = pxPort->xRxedChars.mask + 1;
+	uint16_t len = 0;
+	uint16_t avail, found;
+	BaseType_t xLineIdle = pdFALSE;
+
+	if (pxPort->rxFrame == NULL && (pxPort->rxFrame = (uint8_t *)pvPortMalloc(sizeof(uint8_t) * size)) == NULL)
+		return 0;
+	if (count == 0 || count > size)
+		count = size;
+	*frame = pxPort->rxFrame;
+
+	for (;;)
+	{
+		// Move what has arrived into the frame in one block, up to and including the delimiter.
+		// Only the bytes searched are taken, one arriving meanwhile may be the delimiter.
+		avail = ringBuffer_GetCount(&(pxPort->xRxedChars));
+		if (avail > count - len)
+			avail = count - len;
+		found = (delimiter != SERIAL_NO_DELIMITER) ? ringBuffer_Find(&(pxPort->xRxedChars), (uint8_t)delimiter, avail) : 0;
+		len += ringBuffer_Read(&(pxPort->xRxedChars), pxPort->rxFrame + len, found ? found : avail);
+		if (found || len >= count)
+			return len;
+
+		// Arm the RX interrupt, then test again: a byte in between is picked up by the next pass.
+		portENTER_CRITICAL();
+		pxPort->rxDelimiter = delimiter;
+		pxPort->rxCount = count - len;
+		pxPort->xRxWaiting = xTaskGetCurrentTaskHandle();
+		portEXIT_CRITICAL();
+
+		if (ringBuffer_IsEmpty(&(pxPort->xRxedChars)) &&
+			ulTaskNotifyTakeIndexed(SERIAL_NOTIFY_INDEX, pdTRUE, idle) == 0 &&
+			ringBuffer_IsEmpty(&(pxPort->xRxedChars)))
+			xLineIdle = pdTRUE; // the line stayed idle for the whole gap
+
+		portENTER_CRITICAL();
+		pxPort->xRxWaiting = NULL;
+		portEXIT_CRITICAL();
+		// A byte after the last take notified us again, drop it before the next wait.
+		xTaskNotifyStateClearIndexed(NULL, SERIAL_NOTIFY_INDEX);
+		ulTaskNotifyValueClearIndexed(NULL, SERIAL_NOTIFY_INDEX, 0xFFFFFFFFUL);
+
+		if (xLineIdle)
+			return len;
+	}
+}
+
+void xSerialGetStats(xComPortHandlePtr pxPort, xSerialStats *stats)
+{
+	portENTER_CRITICAL();
+	*stats = pxPort->stats;
+	portEXIT_CRITICAL();
+}
+
+void xSerialClearStats(xComPortHandlePtr pxPort)
+{
+	portENTER_CRITICAL();
+	memset(&(pxPort->stats), 0, sizeof(pxPort->stats));
+	portEXIT_CRITICAL();
+}
+
+void xSerialPrintStats(xComPortHandlePtr pxPort)
+{
+	xSerialStats stats;
+
+	if (!pxPort->initialised || !xSerialPort.initialised)
+		return;
+
+	xSerialGetStats(pxPort, &stats);
+	xSerialxPrintf_P(&xSerialPort, PSTR("\r\nUSART%u FE:%u DOR:%u UPE:%u drop:%u rx:%u/%u tx:%u/%u"),
+					 pxPort->usart, stats.frameErrors, stats.overruns, stats.parityErrors, stats.rxDrops,
+					 stats.rxHighWater, pxPort->xRxedChars.mask + 1, stats.txHighWater, pxPort->xCharsForTx.mask + 1);
 }
 /*-----------------------------------------------------------*/
 
@@ -254,39 +524,10 @@ inline UBaseType_t xSerialGetChar(xComPortHandlePtr pxPort, UBaseType_t *pcRxedC
 
 inline UBaseType_t xSerialPutChar(xComPortHandlePtr pxPort, const UBaseType_t cOutChar)
 {
-	/* Return false if there remains no room on the Tx ring buffer */
-	if (!ringBuffer_IsFull(&(pxPort->xCharsForTx)))
-		ringBuffer_Poke(&(pxPort->xCharsForTx), cOutChar); // poke in a fast byte
-	else
-	{
-		// go slower, per character rate for 115200 is 86us
-		// _delay_us(25); // delay for about one character (maximum _delay_loop_1() delay is 32 us at 22MHz)
-		// _delay_us(25);
-		// _delay_us(25);
-		// _delay_us(25);
+	uint8_t c = cOutChar;
 
-		// go slower, per character rate for 38400 is 28ms
-		_delay_ms(32); // delay for about one character
-
-		if (!ringBuffer_IsFull(&(pxPort->xCharsForTx)))
-			ringBuffer_Poke(&(pxPort->xCharsForTx), cOutChar); // poke in a byte slowly
-		else
-			return pdFAIL; // if the Tx ring buffer remains full
-	}
-	switch (pxPort->usart)
-	{
-	case USART0:
-		vInterrupt0_On();
-		break;
-	case USART1:
-		vInterrupt1_On();
-		break;
-	case USART2:
-	case USART3:
-	default:
-		break;
-	}
-	return pdPASS;
+	/* Return false if there remains no room on the Tx ring buffer */
+	return xSerialWrite(pxPort, &c, 1) ? pdPASS : pdFAIL;
 }
 /*-----------------------------------------------------------*/
 
@@ -306,8 +547,14 @@ xComPortHandle xSerialPortInitMinimal(eCOMPort ePort, uint32_t ulWantedBaud, uin
 		newComPort.serialWorkBuffer = NULL;
 	newComPort.usart = ePort;						   // containing eCOMPort
 	newComPort.serialWorkBufferSize = uxTxQueueLength; // size of the working buffer for vsnprintf
-	newComPort.serialWorkBufferInUse = VACANT;		   // clear the occupation flag.
+	newComPort.xTxMutex = xSemaphoreCreateMutex();	   // serializes the writers, NULL drops all output.
+	newComPort.xTxWaiting = NULL;					   // no writer blocked on the Tx ring yet.
+	newComPort.xRxWaiting = NULL;					   // no reader blocked on a frame yet.
+	newComPort.rxFrame = NULL;						   // the frame buffer is only created by xSerialReceiveFrame().
+	memset(&(newComPort.stats), 0, sizeof(newComPort.stats)); // no errors counted yet.
+	newComPort.initialised = pdTRUE;					   // the port is open, xSerialPrintStats() may use it.
 	portENTER_CRITICAL();
+	usartAttach(newComPort.usart, &xSerialUsart); // USART0 and USART1 bytes go to xSerialPort and xSerial1Port.
 	switch (newComPort.usart)
 	{
 	case USART0:
@@ -357,11 +604,16 @@ void vSerialClose(xComPortHandlePtr oldComPortPtr)
 	uint8_t ucByte;
 	/* Turn off the interrupts.  We may also want to delete the queues and/or
 	re-install the original ISR. */
+	oldComPortPtr->initialised = pdFALSE;
 	vPortFree(oldComPortPtr->serialWorkBuffer);
 	vPortFree(oldComPortPtr->xRxedChars.start);
 	vPortFree(oldComPortPtr->xCharsForTx.start);
+	vPortFree(oldComPortPtr->rxFrame);
+	if (oldComPortPtr->xTxMutex != NULL)
+		vSemaphoreDelete(oldComPortPtr->xTxMutex);
 	portENTER_CRITICAL();
 	{
+		usartAttach(oldComPortPtr->usart, NULL);
 		switch (oldComPortPtr->usart)
 		{
 		case USART0:
@@ -390,12 +642,10 @@ void avrSerialPrintf(const char *format, ...)
 {
 	va_list arg;
 	va_start(arg, format);
-	while (xSerialPort.serialWorkBufferInUse == ENGAGED)
-		_delay_us(25);
-	xSerialPort.serialWorkBufferInUse = ENGAGED;
+	prvSerialLock(&xSerialPort);
 	vsnprintf((char *)(xSerialPort.serialWorkBuffer), xSerialPort.serialWorkBufferSize, (const char *)format, arg);
 	avrSerialPrint((xSerialPort.serialWorkBuffer));
-	xSerialPort.serialWorkBufferInUse = VACANT;
+	prvSerialUnlock(&xSerialPort);
 	va_end(arg);
 }
 
@@ -403,12 +653,10 @@ void avrSerialPrintf_P(PGM_P format, ...)
 {
 	va_list arg;
 	va_start(arg, format);
-	while (xSerialPort.serialWorkBufferInUse == ENGAGED)
-		_delay_us(25);
-	xSerialPort.serialWorkBufferInUse = ENGAGED;
+	prvSerialLock(&xSerialPort);
 	vsnprintf_P((char *)(xSerialPort.serialWorkBuffer), xSerialPort.serialWorkBufferSize, format, arg);
 	avrSerialPrint((xSerialPort.serialWorkBuffer));
-	xSerialPort.serialWorkBufferInUse = VACANT;
+	prvSerialUnlock(&xSerialPort);
 	va_end(arg);
 }
 
@@ -471,12 +719,10 @@ void avrSerialxPrintf(xComPortHandlePtr pxPort, const char *format, ...)
 {
 	va_list arg;
 	va_start(arg, format);
-	while (pxPort->serialWorkBufferInUse == ENGAGED)
-		_delay_us(25);
-	pxPort->serialWorkBufferInUse = ENGAGED;
+	prvSerialLock(pxPort);
 	vsnprintf((char *)(pxPort->serialWorkBuffer), pxPort->serialWorkBufferSize, (const char *)format, arg);
 	avrSerialxPrint(pxPort, pxPort->serialWorkBuffer);
-	pxPort->serialWorkBufferInUse = VACANT;
+	prvSerialUnlock(pxPort);
 	va_end(arg);
 }
 
@@ -484,12 +730,10 @@ void avrSerialxPrintf_P(xComPortHandlePtr pxPort, PGM_P format, ...)
 {
 	va_list arg;
 	va_start(arg, format);
-	while (pxPort->serialWorkBufferInUse == ENGAGED)
-		_delay_us(25);
-	pxPort->serialWorkBufferInUse = ENGAGED;
+	prvSerialLock(pxPort);
 	vsnprintf_P((char *)(pxPort->serialWorkBuffer), pxPort->serialWorkBufferSize, format, arg);
 	avrSerialxPrint(pxPort, pxPort->serialWorkBuffer);
-	pxPort->serialWorkBufferInUse = VACANT;
+	prvSerialUnlock(pxPort);
 	va_end(arg);
 }
 
@@ -590,67 +834,3 @@ inline int8_t avrSerialxCheckTxReady(xComPortHandlePtr pxPort)
 	return 0;
 }
 /*-----------------------------------------------------------*/
-
-ISR(USART0_RX_vect)
-{
-	uint8_t cChar;
-	/* Get status and data from buffer */
-
-	/* If error bit set (Frame Error, Data Over Run, Parity), return nothing */
-	if (!(UCSR0A & ((1 << FE0) | (1 << DOR0) | (1 << UPE0))))
-	{
-		/* If no error, get the character and post it on the buffer of Rxed characters.*/
-		cChar = UDR0;
-
-		if (!ringBuffer_IsFull(&(xSerialPort.xRxedChars)))
-			ringBuffer_Poke(&(xSerialPort.xRxedChars), cChar);
-	}
-}
-/*-----------------------------------------------------------*/
-
-ISR(USART0_UDRE_vect)
-{
-	if (ringBuffer_IsEmpty(&(xSerialPort.xCharsForTx)))
-	{
-		// Queue empty, nothing to send.
-		vInterrupt0_Off();
-	}
-	else
-	{
-		UDR0 = ringBuffer_Pop(&(xSerialPort.xCharsForTx));
-	}
-}
-/*-----------------------------------------------------------*/
-
-#if (0) // define this routines in yaMBSiavr.c
-ISR(USART1_RX_vect)
-{
-	uint8_t cChar;
-	/* Get status and data from buffer */
-
-	/* If error bit set (Frame Error, Data Over Run, Parity), return nothing */
-	if (!(UCSR1A & ((1 << FE1) | (1 << DOR1) | (1 << UPE1))))
-	{
-		/* If no error, get the character and post it on the buffer of Rxed characters. */
-		cChar = UDR1;
-
-		if (!ringBuffer_IsFull(&(xSerial1Port.xRxedChars)))
-			ringBuffer_Poke(&(xSerial1Port.xRxedChars), cChar);
-	}
-}
-/*-----------------------------------------------------------*/
-
-ISR(USART1_UDRE_vect)
-{
-	if (ringBuffer_IsEmpty(&(xSerial1Port.xCharsForTx)))
-	{
-		// Queue empty, nothing to send.
-		vInterrupt1_Off();
-	}
-	else
-	{
-		UDR1 = ringBuffer_Pop(&(xSerial1Port.xCharsForTx));
-	}
-}
-/*-----------------------------------------------------------*/
-#endif
@@ -63,7 +63,9 @@ extern "C"
 
 #include <avr/pgmspace.h>
 
+#include "task.h"
 #include "queue.h"
+#include "semphr.h"
 #include "portable.h"
 
 #include "ringBuffer.h"
@@ -76,11 +78,15 @@ extern "C"
         USART3
     } eCOMPort;
 
-    typedef enum
+    typedef struct
     {
-        VACANT,
-        ENGAGED
-    } binary;
+        uint16_t frameErrors;  // bytes received with a framing error (FE), dropped.
+        uint16_t overruns;     // bytes received after a data overrun (DOR), dropped; earlier ones were lost in the USART.
+        uint16_t parityErrors; // bytes received with a parity error (UPE), dropped.
+        uint16_t rxDrops;      // good bytes dropped on a full xRxedChars.
+        uint16_t rxHighWater;  // most bytes xRxedChars has held.
+        uint16_t txHighWater;  // most bytes xCharsForTx has held.
+    } xSerialStats;
 
     typedef struct
     {
@@ -89,9 +95,19 @@ extern "C"
         ringBuffer_t xCharsForTx;
         uint8_t *serialWorkBuffer;     // create a working buffer pointer, to later be malloc() on the heap.
         uint16_t serialWorkBufferSize; // size of working buffer as created on the heap.
-        binary serialWorkBufferInUse;  // flag to prevent overwriting by multiple tasks using the same USART.
+        SemaphoreHandle_t xTxMutex;    // output lock, serializing the tasks writing to xCharsForTx and serialWorkBuffer.
+        TaskHandle_t xTxWaiting;       // task blocked on a full xCharsForTx, notified by the UDRE interrupt.
+        TaskHandle_t xRxWaiting;       // task blocked in xSerialReceiveFrame(), notified by the RX interrupt.
+        int16_t rxDelimiter;           // byte that ends the awaited frame, or SERIAL_NO_DELIMITER.
+        uint16_t rxCount;              // number of buffered bytes that ends the awaited frame.
+        uint8_t *rxFrame;              // contiguous frame handed out by xSerialReceiveFrame(), malloc() on first use.
+        xSerialStats stats;            // error and buffer statistics, kept by the interrupts and xSerialWrite().
+        uint8_t initialised;           // set by xSerialPortInitMinimal(), cleared by vSerialClose(). A port never opened stays zero.
     } xComPortHandle, *xComPortHandlePtr;
 
+#define SERIAL_NO_DELIMITER (-1) // xSerialReceiveFrame() delimiter value to end frames on count or idle gap only.
+#define SERIAL_NOTIFY_INDEX 1     // task notification the interrupts wake a blocked writer or reader with, index 0 is left to the application.
+
     /* Create reference to the handle for the serial port, USART0. */
     /* This variable is special, as it is used in the interrupt */
     extern xComPortHandle xSerialPort;
@@ -115,12 +131,11 @@ extern "C"
 
     // xSerialPrintf_P(PSTR("\r\nMessage %u %u %u"), var1, var2, var2);
 
-    /* If you are worried about race situations on the serial port, then you should implement
-     * a semaphore to limit this case.
-     * Since I just use the serial port for debugging mainly, there seems to be too much
-     * overhead to build this semaphore into the print functions themselves.
-     *
-     * This is now alleviated by using xSerialPort.serialWorkBufferInUse in xSerialPrintf(_P)();
+    /* Writers to a port are serialized by its xTxMutex, which has priority inheritance.
+     * The Tx ring buffer takes a single producer, so a port whose mutex could not be created
+     * queues nothing. The Rx ring buffer has no lock: read a port from one task only.
+     * xSerialPrintf(_P)() format into the shared serialWorkBuffer while holding it;
+     * xSerialxPrintfBuffer(_P)() format into the caller's buffer and hold it only for the copy.
      */
 
     /**
@@ -150,6 +165,15 @@ extern "C"
     // These can be set to use any USART (but only two implemented for now).
     void xSerialxPrintf(xComPortHandlePtr pxPort, const char *format, ...);
     void xSerialxPrintf_P(xComPortHandlePtr pxPort, PGM_P format, ...);
+
+    /**
+     * Serial printf through a caller supplied format buffer, such as a small static one per task.
+     * Only the copy into the Tx ring buffer holds the port's output lock.
+     * @return number of bytes queued.
+     */
+    uint16_t xSerialxPrintfBuffer(xComPortHandlePtr pxPort, char *buf, size_t size, const char *format, ...);
+    uint16_t xSerialxPrintfBuffer_P(xComPortHandlePtr pxPort, char *buf, size_t size, PGM_P format, ...);
+
     void xSerialxPrint(xComPortHandlePtr pxPort, uint8_t *str) __attribute__((flatten));
     void xSerialxPrint_P(xComPortHandlePtr pxPort, PGM_P str) __attribute__((flatten));
 
@@ -161,6 +185,46 @@ extern "C"
 
     UBaseType_t xSerialGetChar(xComPortHandlePtr pxPort, UBaseType_t *pcRxedChar) __attribute__((flatten));
     UBaseType_t xSerialPutChar(xComPortHandlePtr pxPort, const UBaseType_t cOutChar) __attribute__((flatten));
+
+    /**
+     * Copy a block into the Tx ring buffer, blocking up to portSERIAL_TX_TIMEOUT whenever it is full.
+     * @return number of bytes queued, less than len on timeout.
+     */
+    uint16_t xSerialWrite(xComPortHandlePtr pxPort, const uint8_t *buf, uint16_t len);
+
+    /**
+     * Copy up to len received bytes out of the Rx ring buffer, without blocking.
+     * @return number of bytes copied.
+     */
+    uint16_t xSerialRead(xComPortHandlePtr pxPort, uint8_t *buf, uint16_t len);
+
+    /**
+     * Block until the RX interrupt has seen the delimiter, count bytes have arrived, or the line
+     * has been idle. The idle gap is counted in ticks from the last wake up, so a frame ends between
+     * idle and twice idle ticks after its last byte.
+     * @param delimiter byte ending the frame, included in it, or SERIAL_NO_DELIMITER.
+     * @param count frame length limit, 0 or more than the Rx ring buffer size for the ring buffer size.
+     * @param idle gap in ticks ending the frame, portMAX_DELAY to wait for delimiter or count only.
+     * @param frame set to the contiguous frame, valid until the next call on this port.
+     * @return frame length, 0 if nothing arrived within idle ticks or the frame buffer could not be allocated.
+     */
+    uint16_t xSerialReceiveFrame(xComPortHandlePtr pxPort, int16_t delimiter, uint16_t count, TickType_t idle, uint8_t **frame);
+
+    /**
+     * Copy the port's error and buffer statistics, consistently with the interrupts.
+     */
+    void xSerialGetStats(xComPortHandlePtr pxPort, xSerialStats *stats);
+
+    /**
+     * Zero the port's statistics, including the ring buffer high water marks.
+     */
+    void xSerialClearStats(xComPortHandlePtr pxPort);
+
+    /**
+     * Print the port's statistics on the xSerialPort console, one line.
+     * Nothing is printed unless both the port and the console are open.
+     */
+    void xSerialPrintStats(xComPortHandlePtr pxPort);
     /*-----------------------------------------------------------*/
 
     // Polling write and read routines, for use before freeRTOS vTaskStartScheduler
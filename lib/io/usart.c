@@ -0,0 +1,95 @@
+/*
+ * usart.c
+ *
+ *  USART driver core, see usart.h.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "usart.h"
+
+// protocol serving each port, read by the ISRs
+static const __flash usartHandler_t *volatile usartHandler[USART_PORTS];
+
+void usartAttach(uint8_t port, const __flash usartHandler_t *handler)
+{
+	if (port >= USART_PORTS)
+		return;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		usartHandler[port] = handler;
+	}
+}
+
+// Bodies of the ISRs, inlined with constant registers so only the handler call is indirect
+
+static inline __attribute__((always_inline)) void usartRx(uint8_t n, volatile uint8_t *ucsra, volatile uint8_t *udr)
+{
+	const __flash usartHandler_t *h = usartHandler[n];
+	uint8_t status = *ucsra;
+	uint8_t data = *udr; // read also without a handler, it clears RXC
+	uint8_t woken = 0;
+
+	if (h != NULL)
+		h->rx(n, status, data, &woken);
+	if (woken)
+		taskYIELD();
+}
+
+static inline __attribute__((always_inline)) void usartUdre(uint8_t n, volatile uint8_t *ucsrb, volatile uint8_t *udr)
+{
+	const __flash usartHandler_t *h = usartHandler[n];
+	uint8_t woken = 0;
+	int16_t data = (h != NULL) ? h->udre(n, &woken) : -1;
+
+	if (data < 0)
+		*ucsrb &= ~_BV(UDRIE0); // nothing more to send, UDRIE has the same position on both USARTs
+	else
+		*udr = (uint8_t)data;
+	if (woken) // only now, the woken task may run with UDRE pending and send the next byte
+		taskYIELD();
+}
+
+static inline __attribute__((always_inline)) void usartTxc(uint8_t n)
+{
+	const __flash usartHandler_t *h = usartHandler[n];
+
+	if (h != NULL && h->txc != NULL)
+		h->txc(n);
+}
+
+ISR(USART0_RX_vect)
+{
+	usartRx(0, &UCSR0A, &UDR0);
+}
+
+ISR(USART0_UDRE_vect)
+{
+	usartUdre(0, &UCSR0B, &UDR0);
+}
+
+ISR(USART0_TX_vect)
+{
+	usartTxc(0);
+}
+
+ISR(USART1_RX_vect)
+{
+	usartRx(1, &UCSR1A, &UDR1);
+}
+
+ISR(USART1_UDRE_vect)
+{
+	usartUdre(1, &UCSR1B, &UDR1);
+}
+
+ISR(USART1_TX_vect)
+{
+	usartTxc(1);
+}
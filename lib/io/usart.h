@@ -0,0 +1,37 @@
+/*
+ * usart.h
+ *
+ *  USART driver core. It owns the RX, UDRE and TX complete vectors of both
+ *  USARTs and hands the bytes to the protocol attached to the port: the
+ *  serial.c ring buffers, the modbus.c RTU engine, yaMBSiavr.c, or any other
+ *  byte stream. Which protocol serves a port is chosen at run time, main.c
+ *  attaches only serial.c and modbus.c.
+ *
+ *  The driver reads the status and the data registers itself, so handlers
+ *  never touch UDRn. A protocol still sets the baud rate and the frame format,
+ *  enables RXCIE and TXCIE as it needs, and sets UDRIE to start sending.
+ */
+
+#ifndef USART_H_
+#define USART_H_
+
+#include <stdint.h>
+
+#define USART_PORTS 2 // USART0 and USART1 of the ATmega128
+
+typedef struct
+{
+	// byte received, status is UCSRnA as read before UDRn, so FE, DOR and UPE belong to data.
+	// A handler that wakes a higher priority task sets *woken, the driver yields on the way out.
+	void (*rx)(uint8_t port, uint8_t status, uint8_t data, uint8_t *woken);
+	// next byte to send, or -1 when there is none: the driver then clears UDRIE. *woken as for rx,
+	// the yield comes once the byte is in UDRn, so a woken writer cannot get its bytes out first.
+	int16_t (*udre)(uint8_t port, uint8_t *woken);
+	// the last byte has left the shift register, NULL if the protocol does not enable TXCIE
+	void (*txc)(uint8_t port);
+} usartHandler_t;
+
+// Route the port's interrupts to handler, NULL to discard them
+void usartAttach(uint8_t port, const __flash usartHandler_t *handler);
+
+#endif // USART_H_
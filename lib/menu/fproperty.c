@@ -13,7 +13,6 @@
 #include <avr/io.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdio.h>
 
 #include <ctype.h>
 
@@ -23,6 +22,7 @@
 #include <time.h>
 
 #include "lcd.h"
+#include "format.h"
 
 #include <avr/delay.h>
 
@@ -32,35 +32,26 @@ static char tmpstr[DISPLAY_WIDTH + 1];
 
 #if defined(ENABLE_I16_PROPERTIES) || defined(ENABLE_U16_PROPERTIES)
 typedef int32_t big_int;
-#define ITOA(x, y, z) ltoa(x, y, z)
 #else
 typedef int16_t big_int;
-#define ITOA(x, y, z) itoa(x, y, z)
 #endif
 
 static char *numText(big_int num)
 {
-	// ITOA(num, tmpstr, 10);
-	sprintf(tmpstr, "%05ld", num);
+	fmtDec(tmpstr, num, 5, '0', false);
 	return tmpstr;
 }
 
-/*The variable width or precision field (an asterisk * symbol) is not realized
- and will to abort the output. */
+// "%+0{intpart}.{fracpart}f", intpart being the whole field width as in printf
 static char *fnumText(float num, uint8_t intpart, uint8_t fracpart)
 {
-	char *format = "%+04.0f";
-	format[5] = fracpart + '0';
-	format[3] = intpart + '0';
-	sprintf(tmpstr, format, num);
+	fmtFloat(tmpstr, num, fracpart, intpart, '0', true);
 	return tmpstr;
 }
 
 static char *u32NumText(uint32_t num, uint8_t intpart)
 {
-	char *format = "%05lu";
-	format[2] = intpart + '0';
-	sprintf(tmpstr, format, num);
+	fmtUDec(tmpstr, num, intpart, '0');
 	return tmpstr;
 }
 
@@ -82,7 +73,7 @@ static char *dateText(time_t num)
 
 static char *hexText(big_int num, uint8_t dig)
 {
-	ITOA(num, tmpstr, 16);
+	fmtHex(tmpstr, num, 0);
 	return tmpstr;
 }
 
@@ -45,6 +45,11 @@
 #error "AVR-GCC version must be higher than 4.9.x"
 #endif
 
+/// изготовитель, изделие и версия программы (Modbus Read Device Identification)
+#define FW_VENDOR "Totalizer"
+#define FW_PRODUCT "DI-O-5"
+#define FW_VERSION "0.1"
+
 /**
  * Для указания места размещения всех структур \b FlexMenu (в \b RAM или \b FLASH) определен префикс \b _mem.
  * Данный префикс определяется автоматически - см. #PLACE_CONST_IN_FLASH
@@ -8,6 +8,10 @@
 
 #include <stdint.h>
 #include <stdlib.h> /* ANSI memory controls */
+#include <string.h>
+#if defined(__AVR__)
+#include <util/atomic.h>
+#endif
 
 /* Scheduler include files. */
 #include "FreeRTOS.h"
@@ -20,10 +24,9 @@
 
 #include "rtc.h" /* RTC configurations and declarations */
 
-/* structure to receive the DS1307 RTC parameters */
+/* structure to receive the DS1307 RTC parameters (read phase of the transaction, no address byte) */
 typedef struct
 {
-	uint8_t I2CAddress; // Address and read/write bit for I2C transaction. First Byte.
 	uint8_t Second;		//
 	uint8_t Minute;		//
 	uint8_t Hour;		// 1-12, 0-23 (depending on am pm/24 bit 6)
@@ -37,7 +40,6 @@ typedef struct
 // used ONLY for SETTING the time, where the Command byte is required.
 typedef struct
 {
-	uint8_t I2CAddress; // Address and read/write bit for I2C transaction. First Byte.
 	uint8_t Command;	// Command or Address on the I2C bus
 	uint8_t Second;		//
 	uint8_t Minute;		//
@@ -54,69 +56,46 @@ typedef struct
 static uint8_t decToBcd(uint8_t); // Convert normal decimal numbers to binary coded decimal
 static uint8_t bcdToDec(uint8_t); // Convert binary coded decimal to normal decimal numbers
 
+#if defined(__AVR__)
+static void TaskRTC(void *pvParameters);
+
+static TaskHandle_t xRTCTaskHandle = NULL;
+static xRTCStatus xStatus;
+static uint16_t rtcSyncCountdown; // seconds to the next sync
+#endif
+
 /*----------------------------------------------------------------*/
 
 uint8_t getDateTimeDS1307(struct tm *timeDate)
 {
-	uint8_t I2C_command_buf[2];
+	uint8_t I2C_register = 0x00; // register pointer = 0 (Seconds)
 	xDS1307Array xTimeDate;
+	I2C_Transaction_t xTransaction = {DS1307, &I2C_register, 1, (uint8_t *)&xTimeDate, sizeof(xDS1307Array)};
+
+	/*  Reading from the Slave, one transaction
+	1. Send a start sequence
+	2. Send 0xD0 ( I2C address of the DS1307 with the R/W bit low (even address)
+	3. Send 0x00 (Internal address of the bearing register)
+
+	4. Send a start sequence again (repeated start)
+	5. Send 0xD1 ( I2C address of the DS1307 with the R/W bit high (odd address)
+	6. Read data byte from DS1307
+	7. Repeat, reading the next data byte from DS1307
+	8. Send the stop sequence.
+
+	I2C_Master_Transfer() takes the xI2CSemaphore and gives up after I2C_WORST_CASE_US().
+	*/
+	if (I2C_Master_Transfer(&xTransaction) == pdFALSE)
+		return pdFALSE; // return 0 to signify failure.
+
+	timeDate->tm_sec = bcdToDec(xTimeDate.Second & 0x7f);	 // convert one byte 0-59
+	timeDate->tm_min = bcdToDec(xTimeDate.Minute & 0x7f);	 // convert one byte 0-59
+	timeDate->tm_hour = bcdToDec(xTimeDate.Hour & 0x3f);	 // convert one byte 1-23
+	timeDate->tm_wday = bcdToDec(xTimeDate.Day & 0x07) - 1;	 // convert one byte to Sun=0, Mon=1, Tue=2, Wed=3, Thur=4, Fri=5, Sat=6
+	timeDate->tm_mday = bcdToDec(xTimeDate.Date & 0x3f);	 // convert one byte to 1 to 28, 30, or 31
+	timeDate->tm_mon = bcdToDec(xTimeDate.Month & 0x1f) - 1; // convert one byte to Jan=0,... Dec=11
+	timeDate->tm_year = (uint16_t)bcdToDec(xTimeDate.Year);	 // '00 - '99 year
 
-	if (xI2CSemaphore != NULL) // use the xI2CSemaphore if you're sharing the I2C bus.
-							   // Better to do it anyway.
-	{
-		// See if we can obtain the semaphore.  If the semaphore is not available
-		// wait 10 ticks to see if it becomes free.
-		if (xSemaphoreTake(xI2CSemaphore, (TickType_t)10) == pdTRUE)
-		{
-			// We were able to obtain the semaphore and can now access the
-			// shared resource.
-
-			/*  Reading from the Slave
-			1. Send a start sequence
-			2. Send 0xD0 ( I2C address of the DS1307 with the R/W bit low (even address)
-			3. Send 0x00 (Internal address of the bearing register)
-
-			4. Send a start sequence again (repeated start)
-			5. Send 0xD1 ( I2C address of the DS1307 with the R/W bit high (odd address)
-			6. Read data byte from DS1307
-			7. Repeat, reading the next data byte from DS1307
-			8. Send the stop sequence.
-			*/
-
-			I2C_command_buf[0] = DS1307 + I2C_WRITE; // set device address and write mode
-			I2C_command_buf[1] = 0x00;				 // write address = 0 (Seconds)
-
-			if (I2C_Check_Free_After_Stop() == pdTRUE)
-				I2C_Master_Start_Transceiver_With_Data((uint8_t *)&I2C_command_buf, 2);
-
-			xTimeDate.I2CAddress = DS1307 + I2C_READ; // set device address and read mode
-
-			if (I2C_Check_Free_After_Stop() == pdTRUE)
-				// all that matters here is to have the right size of the data we're looking to receive.
-				I2C_Master_Start_Transceiver_With_Data((uint8_t *)&xTimeDate, sizeof(xDS1307Array));
-
-			if (I2C_Master_Get_Data_From_Transceiver((uint8_t *)&xTimeDate, sizeof(xDS1307Array)))
-			{
-				// We have finished accessing the shared resource. Release the i2c semaphore.
-				xSemaphoreGive(xI2CSemaphore);
-
-				timeDate->tm_sec = bcdToDec(xTimeDate.Second & 0x7f);	 // convert one byte 0-59
-				timeDate->tm_min = bcdToDec(xTimeDate.Minute & 0x7f);	 // convert one byte 0-59
-				timeDate->tm_hour = bcdToDec(xTimeDate.Hour & 0x3f);	 // convert one byte 1-23
-				timeDate->tm_wday = bcdToDec(xTimeDate.Day & 0x07) - 1;	 // convert one byte to Sun=0, Mon=1, Tue=2, Wed=3, Thur=4, Fri=5, Sat=6
-				timeDate->tm_mday = bcdToDec(xTimeDate.Date & 0x3f);	 // convert one byte to 1 to 28, 30, or 31
-				timeDate->tm_mon = bcdToDec(xTimeDate.Month & 0x1f) - 1; // convert one byte to Jan=0,... Dec=11
-				timeDate->tm_year = (uint16_t)bcdToDec(xTimeDate.Year);	 // '00 - '99 year
-			}
-			else
-			{
-				// We have finished accessing the shared resource. Release the i2c semaphore.
-				xSemaphoreGive(xI2CSemaphore);
-
-				return pdFALSE; // return 0 to signify failure.
-			}
-		}
-	}
 	return pdTRUE;
 }
 
@@ -126,41 +105,141 @@ uint8_t setDateTimeDS1307(struct tm *timeDateSet)
 {
 	// Holds values for the RTC DS1307
 	xDS1307ArraySto xSettings;
+	I2C_Transaction_t xTransaction = {DS1307, (uint8_t *)&xSettings, sizeof(xDS1307ArraySto), NULL, 0};
+
+	xSettings.Command = 0x00;							 // Write to the first address 0x00 (Seconds)
+	xSettings.Second = decToBcd(timeDateSet->tm_sec);	 // 0-59
+	xSettings.Minute = decToBcd(timeDateSet->tm_min);	 // 0-59
+	xSettings.Hour = decToBcd(timeDateSet->tm_hour);	 // 1-23
+	xSettings.Day = decToBcd(timeDateSet->tm_wday + 1);	 // convert to Sun=1, Mon=2, Tue=3, Wed=4, Thur=5, Fri=6, Sat=7
+	xSettings.Date = decToBcd(timeDateSet->tm_mday);	 // convert one byte to 1 to 28, 30, or 31
+	xSettings.Month = decToBcd(timeDateSet->tm_mon + 1); // convert to Jan=1,... Dec=12
+	xSettings.Year = decToBcd(timeDateSet->tm_year);	 // convert '00 - '99 year
+	xSettings.Control = SQWENABLE;						 // enable the 1Hz square wave
+
+	return I2C_Master_Transfer(&xTransaction);
+}
+
+/*----------------------------------------------------------------*/
+
+#if defined(__AVR__) // host builds (i2cSim.c) have no avr-libc system time
+
+/* The software clock is the avr-libc system time: system_tick() once a second, read with time().
+   Its epoch is 1.1.2000 and tm_year counts from 1900, the DS1307 keeps '00 - '99. */
+
+uint8_t rtcSync(void)
+{
+	struct tm timeDate;
+	time_t chipTime;
+	int32_t drift;
+
+	memset(&timeDate, 0, sizeof(timeDate));
+	if (getDateTimeDS1307(&timeDate) == pdFALSE)
+	{
+		xStatus.syncErrors++;
+		return pdFALSE;
+	}
+	timeDate.tm_year += 100;
+	chipTime = mk_gmtime(&timeDate);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		drift = (int32_t)(chipTime - time(NULL));
+		set_system_time(chipTime);
+		rtcSyncCountdown = RTC_SYNC_PERIOD;
+	}
+
+	if (xStatus.syncs) // the first sync only sets the clock
+	{
+		xStatus.lastDrift = (int16_t)drift;
+		xStatus.totalDrift += drift;
+	}
+	xStatus.lastSync = chipTime;
+	xStatus.syncs++;
+	return pdTRUE;
+}
+
+uint8_t rtcSetTime(time_t newTime)
+{
+	struct tm timeDate;
+
+	gmtime_r(&newTime, &timeDate);
+	timeDate.tm_year -= 100;
+	if (setDateTimeDS1307(&timeDate) == pdFALSE)
+		return pdFALSE;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		set_system_time(newTime);
+		rtcSyncCountdown = RTC_SYNC_PERIOD;
+	}
+	xStatus.lastSync = newTime;
+	return pdTRUE;
+}
+
+void rtcGetStatus(xRTCStatus *status)
+{
+	portENTER_CRITICAL();
+	*status = xStatus;
+	portEXIT_CRITICAL();
+}
+
+void rtcServiceStart(void)
+{
+	if (xRTCTaskHandle == NULL)
+		xTaskCreate(TaskRTC, (const char *)"RTC", RTC_TASK_STACK, NULL, RTC_TASK_PRIORITY, &xRTCTaskHandle);
+}
+
+#ifdef RTC_USE_SQW
+void rtcSqwTickFromISR(void)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+	system_tick();
+	if (rtcSyncCountdown && (--rtcSyncCountdown == 0) && (xRTCTaskHandle != NULL))
+		vTaskNotifyGiveFromISR(xRTCTaskHandle, &xHigherPriorityTaskWoken);
+	if (xHigherPriorityTaskWoken)
+		taskYIELD();
+}
+#endif
+
+static void TaskRTC(void *pvParameters)
+{
+	(void)pvParameters;
+#ifndef RTC_USE_SQW
+	TickType_t xLastWakeTime;
+	uint8_t due;
+#endif
+
+	if (rtcSync() == pdFALSE)
+		rtcSyncCountdown = RTC_SYNC_PERIOD;
 
-	if (xI2CSemaphore != NULL) // use the xI2CSemaphore if you're sharing the I2C bus.
+#ifdef RTC_USE_SQW
+	for (;;) // the SQW interrupt keeps the time, wake up only to re-sync.
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if (rtcSync() == pdFALSE)
+			rtcSyncCountdown = RTC_SYNC_PERIOD;
+	}
+#else
+	xLastWakeTime = xTaskGetTickCount();
+	for (;;) // the RTOS tick keeps the time, without accumulating the task latency.
 	{
-		// See if we can obtain the semaphore.  If the semaphore is not available
-		// wait 10 ticks to see if it becomes free.
-		if (xSemaphoreTake(xI2CSemaphore, (TickType_t)10) == pdTRUE)
+		xTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(1000));
+
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 		{
-			xSettings.I2CAddress = DS1307 + I2C_WRITE;			 // set device address and write mode
-			xSettings.Command = 0x00;							 // Write to the first address 0x00 (Seconds)
-			xSettings.Second = decToBcd(timeDateSet->tm_sec);	 // 0-59
-			xSettings.Minute = decToBcd(timeDateSet->tm_min);	 // 0-59
-			xSettings.Hour = decToBcd(timeDateSet->tm_hour);	 // 1-23
-			xSettings.Day = decToBcd(timeDateSet->tm_wday + 1);	 // convert to Sun=1, Mon=2, Tue=3, Wed=4, Thur=5, Fri=6, Sat=7
-			xSettings.Date = decToBcd(timeDateSet->tm_mday);	 // convert one byte to 1 to 28, 30, or 31
-			xSettings.Month = decToBcd(timeDateSet->tm_mon + 1); // convert to Jan=1,... Dec=12
-			xSettings.Year = decToBcd(timeDateSet->tm_year);	 // convert '00 - '99 year
-			xSettings.Control = SQWENABLE;						 // enable the 1Hz square wave
-
-			if (I2C_Check_Free_After_Stop() == pdTRUE)
-			{
-				I2C_Master_Start_Transceiver_With_Data((uint8_t *)&xSettings, sizeof(xDS1307ArraySto));
-
-				// We have finished accessing the shared resource. Release the i2c semaphore.
-				xSemaphoreGive(xI2CSemaphore);
-			}
-			else
-			{
-				xSemaphoreGive(xI2CSemaphore);
-				return pdFALSE;
-			}
+			system_tick();
+			due = (--rtcSyncCountdown == 0);
 		}
+		if (due && (rtcSync() == pdFALSE))
+			rtcSyncCountdown = RTC_SYNC_PERIOD;
 	}
-	return pdTRUE;
+#endif
 }
 
+#endif // __AVR__
+
 /*----------------------------------------------------------------*/
 
 // Convert normal decimal number byte to binary coded decimal byte
@@ -20,9 +20,37 @@
 #define SQWRS1 0b00000010        //  RS1 & RS0 set to 0 for 1Hz output
 #define SQWRS0 0b00000001
 
+/* Software clock. time() is kept in RAM and disciplined from the DS1307 every RTC_SYNC_PERIOD seconds. */
+#ifndef RTC_SYNC_PERIOD
+#define RTC_SYNC_PERIOD 3600 // seconds between re-syncs from the DS1307
+#endif
+#ifndef RTC_TASK_PRIORITY
+#define RTC_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#endif
+#define RTC_TASK_STACK 160
+// #define RTC_USE_SQW        // define if the DS1307 SQW pin is wired to an interrupt that calls rtcSqwTickFromISR()
+
+typedef struct
+{
+	time_t lastSync;	 // software time of the last successful sync
+	int16_t lastDrift;	 // DS1307 - software time at the last sync, seconds
+	int32_t totalDrift;	 // sum of all corrections since start, seconds
+	uint16_t syncs;		 // successful syncs
+	uint16_t syncErrors; // failed DS1307 reads
+} xRTCStatus;
+
 /*----------------------------------------------------------------*/
 uint8_t getDateTimeDS1307(struct tm *timeDate);    // Get the date & time as needed.
 uint8_t setDateTimeDS1307(struct tm *timeDateSet); // Set the date & time initially & as needed.
 /*----------------------------------------------------------------*/
+void rtcServiceStart(void);			// Create the clock task, it syncs from the DS1307 at once.
+uint8_t rtcSetTime(time_t newTime); // Set the DS1307 and the software clock.
+uint8_t rtcSync(void);				// Re-sync the software clock from the DS1307 now.
+void rtcGetStatus(xRTCStatus *status);
+#ifdef RTC_USE_SQW
+void rtcSqwTickFromISR(void); // Call from the SQW pin interrupt, once a second.
+#endif
+// Read the software clock with time(NULL), gmtime_r() or localtime_r(). No bus access.
+/*----------------------------------------------------------------*/
 
 #endif /* RTC_H_ */
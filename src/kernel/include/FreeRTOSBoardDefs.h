@@ -137,11 +137,16 @@ extern "C"
 
 #define portHD44780_LCD // define the use of the Freetronics HD44780 LCD (or other). Check include hd44780.h for (flexible) pin assignments.
     // #define portSD_CARD // define the use of the SD Card for Arduino Mega2560 and Freetronics EtherMega
-    //  #define portRTC_DEFINED                             // RTC DS1307 / DS3231 implemented, therefore define.
+#define portRTC_DEFINED                                 // RTC DS1307 / DS3231 implemented, therefore define.
 
-#define portSERIAL_BUFFER_RX 127               // Define the size of the serial receive buffer.
-#define portSERIAL_BUFFER_TX 127               // Define the size of the serial transmit buffer, only as long as the longest line of text.
+#define portSERIAL_BUFFER_RX 128               // Define the size of the serial receive buffer.
+#define portSERIAL_BUFFER_TX 128               // Define the size of the serial transmit buffer, only as long as the longest line of text.
 #define portSERIAL_BUFFER portSERIAL_BUFFER_TX // just for compatibility with older programmes.
+#define portSERIAL_TX_TIMEOUT pdMS_TO_TICKS(100) // Longest a writer blocks on a full transmit buffer before the character is dropped.
+
+// #define portMODBUS_USART0 // main.c attaches the modbus.c RTU slave to USART0 in place of the xSerialPort debug console.
+#define portMODBUS_USART1 // main.c attaches the modbus.c RTU slave to USART1. Undefined, USART1 is left unattached.
+    // #define portMODBUS_MASTER // USART1 polls the downstream meters of mbPollSchedule (modbus_master.c) instead of serving the SCADA.
 
     //  #define portUSE_TIMER1_PWM                          // Define which Timer to use as the PWM Timer (not the tick timer).
 
@@ -219,8 +224,8 @@ extern "C"
 #define portSD_CARD    // define the use of the SD Card for Arduino Mega2560 and Freetronics EtherMega
 //  #define portRTC_DEFINED                             // RTC DS1307 / DS3231 implemented, therefore define.
 
-#define portSERIAL_BUFFER_RX 255               // Define the size of the serial receive buffer.
-#define portSERIAL_BUFFER_TX 255               // Define the size of the serial transmit buffer, only as long as the longest line of text.
+#define portSERIAL_BUFFER_RX 128               // Define the size of the serial receive buffer.
+#define portSERIAL_BUFFER_TX 128               // Define the size of the serial transmit buffer, only as long as the longest line of text.
 #define portSERIAL_BUFFER portSERIAL_BUFFER_TX // just for compatibility with older programmes.
 
 //  #define portUSE_TIMER1_PWM                          // Define which Timer to use as the PWM Timer (not the tick timer).
@@ -280,8 +285,8 @@ extern "C"
 #define portANALOGUE                          // Goldilocks Analogue Capabilities
 //  #define portANALOGSHIELD                                // Digilent Analog Shield (only DAC implemented)
 
-#define portSERIAL_BUFFER_RX 255               // Define the size of the serial receive buffer.
-#define portSERIAL_BUFFER_TX 255               // Define the size of the serial transmit buffer, only as long as the longest text.
+#define portSERIAL_BUFFER_RX 128               // Define the size of the serial receive buffer.
+#define portSERIAL_BUFFER_TX 128               // Define the size of the serial transmit buffer, only as long as the longest text.
 #define portSERIAL_BUFFER portSERIAL_BUFFER_TX // just for compatibility with older programmes.
 
 //  #define portUSE_TIMER1_PWM                              // Define which Timer to use as the PWM Timer (not the tick timer).
@@ -29,7 +29,9 @@
 #ifndef FREERTOS_CONFIG_H
 #define FREERTOS_CONFIG_H
 
+#if defined(__AVR__)
 #include <avr/io.h>
+#endif
 
 /*-----------------------------------------------------------
  * Application specific definitions.
@@ -67,6 +69,8 @@
 #define configUSE_COUNTING_SEMAPHORES 1
 #define configUSE_TIME_SLICING 1
 
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES 2 // 0: modbus.c port bits, 1: serial.c blocking waits (SERIAL_NOTIFY_INDEX)
+
 #define configUSE_QUEUE_SETS 0
 #define configUSE_APPLICATION_TASK_TAG 0
 #define configUSE_MALLOC_FAILED_HOOK 0
@@ -101,7 +105,7 @@ to exclude the API function. */
 #define INCLUDE_xTaskResumeFromISR 1
 #define INCLUDE_xTaskDelayUntil 1
 #define INCLUDE_vTaskDelay 1
-#define INCLUDE_xTaskGetSchedulerState 0
+#define INCLUDE_xTaskGetSchedulerState 1
 #define INCLUDE_xTaskGetCurrentTaskHandle 1
 #define INCLUDE_uxTaskGetStackHighWaterMark 1
 #define INCLUDE_xTaskGetIdleTaskHandle 0
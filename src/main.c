@@ -23,6 +23,7 @@
 #include <util/delay.h>
 #include <util/atomic.h>
 #include <math.h>
+#include <time.h>
 
 /* RTOS Scheduler include files. */
 #include "FreeRTOS.h"
@@ -34,10 +35,12 @@
 
 #include "board.h"
 #include "modbus.h"
+#include "mbregmap.h"
 #include "totalizer.h"
 #include "avr8gpio.h"
 
 #include "lcd.h"
+#include "format.h"
 #include "char_pattern.h"
 #include "onebutton.h"
 #include "char_pattern.h"
@@ -49,18 +52,16 @@
 #include "mcp401x.h"
 #include "mcp4726.h"
 #include "yaMBSiavr.h"
+#include "crc16.h"
 
 /* serial interface include file. */
 #include "serial.h"
 #include "ver.h"
 
-#define REG_COUNT 16
-
 // volatile uint8_t instate = 0;
-volatile uint16_t inputRegisters[REG_COUNT];
-volatile uint16_t holdingRegisters[REG_COUNT];
 
 volatile uint16_t g_periodH;
+volatile uint16_t g_timer3H;
 volatile uint32_t g_period;
 volatile uint32_t g_pulses0;
 volatile uint32_t g_pulses1;
@@ -77,6 +78,9 @@ static void TaskPollButton(void *pvParameters);
 static void TaskModbus(void *pvParameters);
 static void boardInit(void);
 static void deadBeef(void);
+#if defined(CRC16_BENCH) && !defined(portMODBUS_USART0)
+static void crcBench(void);
+#endif
 
 void prvBeepEnable(BaseType_t tone, uint16_t duration);
 void prvBeepDisable(TimerHandle_t xTimer);
@@ -95,9 +99,14 @@ int main(void)
 {
     // setup board specific hardware
     boardInit();
+#if !defined(portMODBUS_USART0)
     // turn on the serial port for debugging or for other USART reasons.
     xSerialPort = xSerialPortInitMinimal(USART0, 115200, portSERIAL_BUFFER_TX, portSERIAL_BUFFER_RX); //  serial port: WantedBaud, TxQueueLength, RxQueueLength (8n1)
-    avrSerialxPrint_P(&xSerial1Port, PSTR("SKE-02 with FreeRTOS - we alive!\n"));                     // Ok, so we're alive...
+    avrSerialxPrint_P(&xSerialPort, PSTR("SKE-02 with FreeRTOS - we alive!\n"));                     // Ok, so we're alive...
+#if defined(CRC16_BENCH)
+    crcBench();
+#endif
+#endif
 
     lcd_init(LCD_DISP_ON);
     OBInit();
@@ -124,6 +133,22 @@ int main(void)
     xTimerPhase1 = xTimerCreate(PSTR("Phase1"), pdMS_TO_TICKS(10), pdFALSE, 0, prvPhase1Callback);
 
     xTaskCreate(TaskPollButton, (const char *)"PollButton", 256, NULL, 2, NULL); // Tested 9 free @ 208
+
+    I2C_Master_Initialise(0); // master only, own address 0 is never answered
+#if defined(portRTC_DEFINED)
+    rtcServiceStart(); // time() from RAM, the DS1307 is only read to discipline it
+#endif
+
+    // Modbus RTU: service laptop on USART0 may write, plant SCADA on USART1 reads only
+#if defined(portMODBUS_USART0)
+    ModBus_Init(0, 1, ModBusBaud0, MB_RW);
+#endif
+#if defined(portMODBUS_USART1) && defined(portMODBUS_MASTER)
+    if (!ModBus_InitMaster(1, ModBusBaud, &mbPollSchedule)) // concentrator, USART1 polls the downstream meters
+        deadBeef();                                          // schedule does not fit mbPollData / mbPollValid
+#elif defined(portMODBUS_USART1)
+    ModBus_Init(1, 247, ModBusBaud, MB_RO);
+#endif
     // xTaskCreate(TaskModbus, (const char *)"TaskModbus", 256, NULL, 1, NULL);     // Tested 9 free @ 208
 
     vTaskStartScheduler();
@@ -187,22 +212,53 @@ static void TaskPollButton(void *pvParameters)
     }
 }
 
-void meterScreen()
+// "chN:HIGH  1234567890" on one LCD row, formatted without vsnprintf on the 20 ms refresh path
+static void meterLine(uint8_t row, PGM_P name, bool pin, uint32_t pulses)
 {
-    bool pin_ch0;
-    bool pin_ch1;
-    bool pin_ch2;
+    char line[LCD_DISP_LENGTH + 1];
+    char *p = line;
+
+    p = fmtStr_P(p, name);
+    p = fmtStr_P(p, pin ? PSTR("HIGH  ") : PSTR("LOW   "));
+    fmtUDec(p, pulses, 10, ' ');
+    lcd_gotoxy(0, row);
+    lcd_puts(line);
+}
 
-    pin_ch0 = GPREAD(COUNT1);
-    pin_ch1 = GPREAD(COUNT2);
-    pin_ch2 = GPREAD(TP7);
+#if defined(portRTC_DEFINED)
+// "2024-02-28  23:59:58" from the software clock, no I2C access on the refresh path
+static void clockLine(uint8_t row)
+{
+    char line[LCD_DISP_LENGTH + 1];
+    char *p = line;
+    time_t now = time(NULL);
+    struct tm tm;
+
+    localtime_r(&now, &tm);
+    p = fmtUDec(p, tm.tm_year + 1900, 4, '0');
+    *p++ = '-';
+    p = fmtUDec(p, tm.tm_mon + 1, 2, '0');
+    *p++ = '-';
+    p = fmtUDec(p, tm.tm_mday, 2, '0');
+    p = fmtStr_P(p, PSTR("  "));
+    p = fmtUDec(p, tm.tm_hour, 2, '0');
+    *p++ = ':';
+    p = fmtUDec(p, tm.tm_min, 2, '0');
+    *p++ = ':';
+    fmtUDec(p, tm.tm_sec, 2, '0');
+    lcd_gotoxy(0, row);
+    lcd_puts(line);
+}
+#endif
 
-    lcd_gotoxy(0, 0);
-    lcd_Printf_P(PSTR("ch0:%s  %10lu"), pin_ch0 ? "HIGH" : "LOW ", g_pulses0);
-    lcd_gotoxy(0, 1);
-    lcd_Printf_P(PSTR("ch1:%s  %10lu"), pin_ch1 ? "HIGH" : "LOW ", g_pulses1);
-    lcd_gotoxy(0, 2);
-    lcd_Printf_P(PSTR("ch2:%s  %10lu"), pin_ch2 ? "HIGH" : "LOW ", g_pulses2);
+void meterScreen()
+{
+    meterLine(0, PSTR("ch0:"), GPREAD(COUNT1), g_pulses0);
+    meterLine(1, PSTR("ch1:"), GPREAD(COUNT2), g_pulses1);
+    meterLine(2, PSTR("ch2:"), GPREAD(TP7), g_pulses2);
+#if defined(portRTC_DEFINED)
+    clockLine(3);
+#endif
     // lcd_gotoxy(0, 3);
     // lcd_Printf_P(PSTR("OCR1C:%14u"), OCR1C);
 }
@@ -304,6 +360,32 @@ static void boardInit(void)
 }
 /*-----------------------------------------------------------*/
 
+#if defined(CRC16_BENCH) && !defined(portMODBUS_USART0)
+// Cycles of the CRC of a 256 bytes frame, table against bit by bit.
+// Interrupts are still off, Timer3 counts clk/1 and the frame fits in one 16 bit period.
+static void crcBench(void)
+{
+    uint8_t buf[256];
+    uint16_t t0, table, bitwise, crc;
+    uint16_t i;
+
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = i * 7 + 3;
+
+    t0 = TCNT3;
+    crc = crc16_update_block(CRC16_INIT, buf, sizeof(buf));
+    table = TCNT3 - t0;
+
+    t0 = TCNT3;
+    if (crc16_bitwise_block(CRC16_INIT, buf, sizeof(buf)) != crc)
+        avrSerialxPrint_P(&xSerialPort, PSTR("CRC16 table mismatch!\n"));
+    bitwise = TCNT3 - t0;
+
+    avrSerialxPrintf_P(&xSerialPort, PSTR("CRC16 256 bytes: table %u, bitwise %u cycles\n"), table, bitwise);
+}
+/*-----------------------------------------------------------*/
+
+#endif
 // sheduler start failure
 static void deadBeef()
 {
@@ -317,10 +399,11 @@ static void deadBeef()
 // INT7 interrupt
 ISR(INT7_vect)
 {
+    static uint16_t tcnt16_last; // Timer3 runs free, it also times the Modbus silence
     uint16_t tcnt16;
     tcnt16 = TCNT3;
-    TCNT3 = 0;
-    g_period = g_period + tcnt16 + g_periodH * 0x010000L;
+    g_period = g_period + (uint32_t)g_periodH * 0x010000L + tcnt16 - tcnt16_last;
+    tcnt16_last = tcnt16;
     g_pulses0++;
     g_periodH = 0;
 }
@@ -337,6 +420,7 @@ ISR(INT6_vect)
 ISR(TIMER3_OVF_vect)
 {
     g_periodH++;
+    g_timer3H++;
 }
 /*-----------------------------------------------------------*/
 
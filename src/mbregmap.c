@@ -0,0 +1,312 @@
+#include <string.h>
+#include <avr/eeprom.h>
+#if defined(__AVR__)
+#include <util/atomic.h>
+#else
+// host build: the map is only used by the thread serving the port
+#define ATOMIC_BLOCK(type)
+#define ATOMIC_RESTORESTATE
+#endif
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "mbregmap.h"
+#include "avr8gpio.h"
+
+// registers taken by a value of the type
+static uint8_t mbWords(uint8_t type)
+{
+    return (type == MB_U16) ? 1 : (type == MB_I64) ? 4 : 2;
+}
+
+// binary search of the entry holding register reg, -1 if there is none
+static int16_t mbFind(const __flash mbRegMap_t *map, uint16_t reg)
+{
+    int16_t lo = 0;
+    int16_t hi = map->count - 1;
+    int16_t mid;
+
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        if (reg < map->regs[mid].address)
+            hi = mid - 1;
+        else if (reg >= map->regs[mid].address + mbWords(map->regs[mid].type))
+            lo = mid + 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+// index of the value word carried by register i of the entry (0 = first register)
+static uint8_t mbWordIndex(const __flash mbReg_t *r, uint8_t i)
+{
+    return (r->flags & MB_LSW_FIRST) ? i : (mbWords(r->type) - 1 - i);
+}
+
+// where the snapshot of the entry is kept: in place in out, or in the head or tail
+// buffer for the entries cut by the bounds of the request
+static uint8_t *mbRaw(const __flash mbReg_t *r, uint16_t start, uint32_t end, uint8_t *out, uint8_t *head, uint8_t *tail)
+{
+    if (r->address < start)
+        return head;
+    if ((uint32_t)r->address + mbWords(r->type) > end)
+        return tail;
+    return out + (r->address - start) * 2;
+}
+
+uint8_t mbRegRead(const __flash mbRegMap_t *map, uint16_t start, uint16_t count, uint8_t *out)
+{
+    const __flash mbReg_t *r;
+    uint8_t value[8];
+    uint8_t head[8]; // entry cut by the start of the request
+    uint8_t tail[8]; // entry cut by the end of the request
+    uint32_t reg;
+    uint32_t end = (uint32_t)start + count;
+    int16_t first = mbFind(map, start);
+    int16_t last, idx;
+    uint8_t i, w;
+
+    if (first < 0)
+        return MB_EX_ILLEGAL_ADDRESS;
+
+    // check the whole request before taking anything
+    for (reg = start, idx = first; reg < end; idx++)
+    {
+        if (idx >= map->count)
+            return MB_EX_ILLEGAL_ADDRESS;
+        r = &map->regs[idx];
+        if ((reg < r->address) || !(r->flags & MB_RO)) // hole in the map or write only
+            return MB_EX_ILLEGAL_ADDRESS;
+        reg = (uint32_t)r->address + mbWords(r->type);
+    }
+    last = idx - 1;
+
+    // Snapshot of all variables in one critical section, so multi register values
+    // and values read together are consistent, then serialize outside of it.
+    // Getters compute, and take their own snapshot, with interrupts enabled.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (idx = first; idx <= last; idx++)
+        {
+            r = &map->regs[idx];
+            if (r->var)
+                memcpy(mbRaw(r, start, end, out, head, tail), r->var, mbWords(r->type) * 2);
+        }
+    }
+    for (idx = first; idx <= last; idx++)
+    {
+        r = &map->regs[idx];
+        if (!r->var)
+            r->get(mbRaw(r, start, end, out, head, tail));
+    }
+
+    // serialize to big endian registers, in place
+    for (reg = start, idx = first; idx <= last; idx++)
+    {
+        r = &map->regs[idx];
+        memcpy(value, mbRaw(r, start, end, out, head, tail), mbWords(r->type) * 2);
+
+        for (i = reg - r->address; (i < mbWords(r->type)) && (reg < end); i++, reg++)
+        {
+            w = mbWordIndex(r, i);
+            out[(reg - start) * 2] = value[w * 2 + 1];
+            out[(reg - start) * 2 + 1] = value[w * 2];
+        }
+    }
+    return MB_EX_NONE;
+}
+
+// value of the entry from the registers in in
+static void mbTake(const __flash mbReg_t *r, const uint8_t *in, uint8_t *value)
+{
+    uint8_t i, w;
+
+    for (i = 0; i < mbWords(r->type); i++)
+    {
+        w = mbWordIndex(r, i);
+        value[w * 2 + 1] = *in++;
+        value[w * 2] = *in++;
+    }
+}
+
+uint8_t mbRegWrite(const __flash mbRegMap_t *map, uint16_t start, uint16_t count, const uint8_t *in)
+{
+    const __flash mbReg_t *r;
+    uint8_t value[8];
+    uint32_t reg;
+    uint32_t end = (uint32_t)start + count;
+    const uint8_t *p;
+    int16_t first = mbFind(map, start);
+    int16_t idx;
+
+    if ((first < 0) || (map->regs[first].address != start))
+        return MB_EX_ILLEGAL_ADDRESS;
+
+    // check everything first, whole values only
+    for (reg = start, p = in, idx = first; reg < end; idx++)
+    {
+        if (idx >= map->count)
+            return MB_EX_ILLEGAL_ADDRESS;
+        r = &map->regs[idx];
+        if ((r->address != reg) || (reg + mbWords(r->type) > end) || !(r->flags & MB_WO) || (r->var == NULL))
+            return MB_EX_ILLEGAL_ADDRESS;
+
+        mbTake(r, p, value);
+        if (r->validate && !r->validate(value))
+            return MB_EX_ILLEGAL_VALUE;
+
+        reg += mbWords(r->type);
+        p += mbWords(r->type) * 2;
+    }
+
+    // then store all values at once
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (reg = start, p = in, idx = first; reg < end; idx++)
+        {
+            r = &map->regs[idx];
+            mbTake(r, p, value);
+            memcpy(r->var, value, mbWords(r->type) * 2);
+            reg += mbWords(r->type);
+            p += mbWords(r->type) * 2;
+        }
+    }
+    return MB_EX_NONE;
+}
+
+// binary search of the bit entry with the address, -1 if there is none
+static int16_t mbFindBit(const __flash mbBitMap_t *map, uint16_t addr)
+{
+    int16_t lo = 0;
+    int16_t hi = map->count - 1;
+    int16_t mid;
+
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        if (addr < map->bits[mid].address)
+            hi = mid - 1;
+        else if (addr > map->bits[mid].address)
+            lo = mid + 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+// the count entries from start must follow each other without holes
+static uint8_t mbCheckBits(const __flash mbBitMap_t *map, uint16_t start, uint16_t count, uint8_t access, int16_t *first)
+{
+    int16_t idx = mbFindBit(map, start);
+    uint16_t i;
+
+    if ((idx < 0) || ((uint16_t)idx + count > map->count))
+        return MB_EX_ILLEGAL_ADDRESS;
+    for (i = 0; i < count; i++)
+    {
+        if ((map->bits[idx + i].address != start + i) || !(map->bits[idx + i].flags & access))
+            return MB_EX_ILLEGAL_ADDRESS;
+    }
+    *first = idx;
+    return MB_EX_NONE;
+}
+
+uint8_t mbBitRead(const __flash mbBitMap_t *map, uint16_t start, uint16_t count, uint8_t *out)
+{
+    const __flash mbBit_t *b;
+    int16_t first;
+    uint16_t i;
+    uint8_t ex = mbCheckBits(map, start, count, MB_RO, &first);
+    bool on;
+
+    if (ex != MB_EX_NONE)
+        return ex;
+
+    memset(out, 0, (count + 7) / 8);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (i = 0; i < count; i++)
+        {
+            b = &map->bits[first + i];
+            on = GPREAD(b->pin) ? !(b->flags & MB_ACTIVE_LOW) : (b->flags & MB_ACTIVE_LOW);
+            if (on)
+                out[i / 8] |= 1 << (i % 8);
+        }
+    }
+    return MB_EX_NONE;
+}
+
+uint8_t mbBitWrite(const __flash mbBitMap_t *map, uint16_t start, uint16_t count, const uint8_t *in)
+{
+    const __flash mbBit_t *b;
+    int16_t first;
+    uint16_t i;
+    uint8_t ex = mbCheckBits(map, start, count, MB_WO, &first);
+    bool high;
+
+    if (ex != MB_EX_NONE)
+        return ex;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (i = 0; i < count; i++)
+        {
+            b = &map->bits[first + i];
+            high = (in[i / 8] >> (i % 8)) & 1;
+            if (b->flags & MB_ACTIVE_LOW)
+                high = !high;
+            GPWRITE(b->pin, high);
+        }
+    }
+    return MB_EX_NONE;
+}
+
+static const __flash mbFile_t *mbFindFile(const __flash mbFileMap_t *map, uint16_t file)
+{
+    uint8_t i;
+
+    for (i = 0; i < map->count; i++)
+    {
+        if (map->files[i].file == file)
+            return &map->files[i];
+    }
+    return NULL;
+}
+
+uint8_t mbFileCheck(const __flash mbFileMap_t *map, uint16_t file, uint16_t record, uint16_t count, uint8_t access)
+{
+    const __flash mbFile_t *f = mbFindFile(map, file);
+
+    if ((f == NULL) || !(f->flags & access) || ((uint32_t)record + count > f->records))
+        return MB_EX_ILLEGAL_ADDRESS;
+    return MB_EX_NONE;
+}
+
+uint8_t mbFileRead(const __flash mbFileMap_t *map, uint16_t file, uint16_t record, uint16_t count, uint8_t *out)
+{
+    uint8_t ex = mbFileCheck(map, file, record, count, MB_RO);
+
+    if (ex != MB_EX_NONE)
+        return ex;
+
+    vTaskSuspendAll(); // the EEPROM is shared with the menu properties
+    eeprom_read_block(out, mbFindFile(map, file)->ee + record * 2, count * 2);
+    xTaskResumeAll();
+    return MB_EX_NONE;
+}
+
+uint8_t mbFileWrite(const __flash mbFileMap_t *map, uint16_t file, uint16_t record, uint16_t count, const uint8_t *in)
+{
+    uint8_t ex = mbFileCheck(map, file, record, count, MB_WO);
+
+    if (ex != MB_EX_NONE)
+        return ex;
+
+    vTaskSuspendAll(); // about 3.4 ms per changed byte
+    eeprom_update_block(in, mbFindFile(map, file)->ee + record * 2, count * 2);
+    xTaskResumeAll();
+    return MB_EX_NONE;
+}
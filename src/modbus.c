@@ -2,262 +2,942 @@
 Modbus slave implementation for STM32 HAL under FreeRTOS.
 (c) 2017 Viacheslav Kaloshin, multik@multik.org
 Licensed under LGPL.
+
+AVR port: RTU slave on USART0 and USART1 at the same time, one engine per port.
+A port can also be handed to the master task of modbus_master.c.
+The receive handler, attached to the usart.c driver core, writes straight into the
+frame buffer of its port and re-arms a Timer3 compare for T3.5 (B for USART1, C for
+USART0), the compare ISR wakes the task once per frame, the answer is built in the
+same buffer and sent from it by the UDRE handler.
+
+Host build (no __AVR__): the same engine serves a pseudo terminal, so the
+slave can be exercised by a test client without the hardware. The bytes go through
+the same ModBusRxByte(), ModBusFrameEnd(), ModBusAnswer(), ModBusUdre() and
+ModBusTxc() as on the target, only the registers and the Timer3 compare are left out.
 **/
 
+#if !defined(__AVR__)
+#define _GNU_SOURCE // posix_openpt() and cfmakeraw() for the host build
+#endif
+
+#include <string.h>
+#if defined(__AVR__)
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
 #include "FreeRTOS.h"
 #include "task.h"
-#include "queue.h"
-#include "semphr.h"
-#include "timers.h"
-#include "event_groups.h"
-#include "cmsis_os.h"
 
 #include "modbus.h"
+#include "mbregmap.h"
+#include "crc16.h"
+#if defined(__AVR__)
+#include "usart.h"
+#include "avr8gpio.h"
+#include "totalizer.h"
+#else
+// one thread reads the pseudo terminal and answers, there is no ISR to lock out
+#define ATOMIC_BLOCK(type)
+#define ATOMIC_RESTORESTATE
+#endif
 
-// If you want directly send to usb-cdc
-// #include "usbd_cdc_if.h"
+// frame buffer states
+#define MB_IDLE 0       // waiting for the first byte of a frame
+#define MB_RECEIVING 1  // bytes are coming, the Timer3 compare watches the silence
+#define MB_PROCESSING 2 // frame complete, owned by the task
+#define MB_SENDING 3    // answer owned by the UDRE and TXC handlers
+
+// receive errors of a frame
+#define MB_ERR_FRAME 0x01   // framing or parity error
+#define MB_ERR_OVERRUN 0x02 // character lost, or frame too long
+#define MB_ERR_GAP 0x04     // more than T1.5 between two characters
+
+#if defined(__AVR__)
+
+// registers of a port. Bit positions are the same on both USARTs.
+typedef struct
+{
+    volatile uint8_t *ucsra;
+    volatile uint8_t *ucsrb;
+    volatile uint8_t *ucsrc;
+    volatile uint8_t *ubrrh;
+    volatile uint8_t *ubrrl;
+    volatile uint16_t *ocr; // Timer3 compare timing T3.5
+    uint8_t ocie;           // its bit in ETIMSK and ETIFR
+    uint16_t de;            // RS485 driver enable pin, 0 if the port has none
+} ModBusHw_t;
 
-QueueHandle_t ModBusInHandle;
-QueueHandle_t ModBusOutHandle;
-TaskHandle_t *ModBusTaskHandle;
+static const ModBusHw_t mb_hw[ModBusPorts] = {
+    {&UCSR0A, &UCSR0B, &UCSR0C, &UBRR0H, &UBRR0L, &OCR3C, _BV(OCIE3C), ModBusDE0},
+    {&UCSR1A, &UCSR1B, &UCSR1C, &UBRR1H, &UBRR1L, &OCR3B, _BV(OCIE3B), ModBusDE1},
+};
 
-uint16_t mb_reg[ModBusRegisters];
+// the bytes of an attached port, from the usart.c driver core
+static void ModBusRx(uint8_t n, uint8_t status, uint8_t data, uint8_t *woken);
+static int16_t ModBusUdre(uint8_t n, uint8_t *woken);
+static void ModBusTxc(uint8_t n);
+static const __flash usartHandler_t ModBusUsart = {ModBusRx, ModBusUdre, ModBusTxc};
+
+#endif // __AVR__
+
+// the engine of a port, request and answer share the buffer
+typedef struct
+{
+    uint8_t buf[ModBusFrameSize];
+    volatile uint16_t count;    // bytes received, or bytes to send
+    volatile uint16_t pos;      // next byte to send
+    volatile uint8_t state;
+    volatile uint16_t last_rx;  // Timer3 count at the last byte received
+    volatile uint8_t t35_wraps; // full Timer3 periods left before T3.5, at low baud rates
+    uint32_t t35;               // T3.5 in Timer3 counts
+    uint16_t t15;               // T1.5 in Timer3 counts
+    volatile uint8_t error;     // MB_ERR_ bits
+    volatile uint8_t skip;      // frame for another slave, only its end is tracked
+    volatile uint32_t rx_end;   // ModBusTime() of the last byte of the frame
+    volatile uint16_t crc;      // running CRC of the received bytes, 0 at the end of a good frame
+    uint8_t addr;      // 0 on a master port, every frame is taken
+    uint8_t access;    // MB_RO or MB_RW, writes are refused on a read only port
+    TaskHandle_t task; // notified at the end of every frame, slave or master task
+} ModBusPort_t;
+
+static ModBusPort_t mb_port[ModBusPorts];
+mbDiag_t mbDiag[ModBusPorts];
+
+static uint16_t ModBusParse(ModBusPort_t *p);
+
+#if defined(__AVR__)
+// Timer3 count extended to 32 bits by its overflows, wraps every 268 s at 16 MHz
+static uint32_t ModBusTime(void)
+{
+    uint16_t high, low;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        high = g_timer3H;
+        low = TCNT3;
+        if ((ETIFR & _BV(TOV3)) && (low < 0x8000)) // overflow not counted yet
+            high++;
+    }
+    return ((uint32_t)high << 16) | low;
+}
+#else
+// monotonic clock in us, the host ModBusTimerHz
+static uint32_t ModBusTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+#endif
+
+// turnaround statistics of an answered frame
+static void ModBusLatency(mbDiag_t *d)
+{
+    uint32_t us = ModBusCountsToUs(d->tx_start - d->rx_end);
+    uint16_t lat = (us > 0xFFFF) ? 0xFFFF : us;
+    uint32_t ms = us / 1000;
+    uint8_t bin = 0;
+
+    if ((d->lat_count == 0) || (lat < d->lat_min))
+        d->lat_min = lat;
+    if (lat > d->lat_max)
+        d->lat_max = lat;
+    d->lat_sum += lat;
+    d->lat_count++;
+    d->lat_avg = d->lat_sum / d->lat_count;
+
+    while (ms && (bin < ModBusHistBins - 1)) // <1ms, 1-2ms, 2-4ms ... 64ms and more
+    {
+        ms >>= 1;
+        bin++;
+    }
+    d->hist[bin]++;
+}
 
-// Here is actual modbus data stores
-uint8_t mb_buf_in[256];
-uint8_t mb_buf_in_count;
-uint8_t mb_addr;
-uint8_t mb_buf_out[256];
-uint8_t mb_buf_out_count;
+// The engine of a port, shared by the interrupt handlers and the host line below.
 
-void ModBusParse(void);
+static void ModBusTxStart(uint8_t n);
 
-void TaskModBus(void *argument)
+// back to waiting for a request
+static void ModBusIdle(ModBusPort_t *p)
 {
+    p->count = 0;
+    p->error = 0;
+    p->state = MB_IDLE;
+}
+
+// one received byte, status as UCSRnA had it, now the Timer3 count at its arrival
+static void ModBusRxByte(ModBusPort_t *p, uint8_t status, uint8_t data, uint16_t now)
+{
+    if (p->skip) // the rest of a frame for another slave
+        return;
+
+    // Check the address as soon as it arrives. Frames for other slaves are neither
+    // stored nor CRC-ed, only their end is tracked to stay in sync with the line.
+    if ((p->state == MB_IDLE) && p->addr && (data != p->addr) && (data != 0))
+    {
+        p->skip = 1;
+        p->state = MB_RECEIVING;
+        return;
+    }
+
+    if (status & (_BV(FE1) | _BV(UPE1)))
+        p->error |= MB_ERR_FRAME;
+    if (status & _BV(DOR1))
+        p->error |= MB_ERR_OVERRUN;
+
+    // more than T1.5 between two characters, by standard the frame is incomplete
+    if ((p->state == MB_RECEIVING) && ((uint16_t)(now - p->last_rx) > p->t15))
+        p->error |= MB_ERR_GAP;
+    p->last_rx = now;
+
+    if (p->count < ModBusFrameSize)
+    {
+        p->crc = crc16_update(p->count ? p->crc : CRC16_INIT, data);
+        p->buf[p->count++] = data;
+    }
+    else // oops, bad frame, by standard we should drop it and no answer
+        p->error |= MB_ERR_OVERRUN;
+
+    p->state = MB_RECEIVING;
+}
+
+// T3.5 of silence after the last byte: true when the frame is ours, for the task to process
+static bool ModBusFrameEnd(uint8_t n)
+{
+    ModBusPort_t *p = &mb_port[n];
+
+    if (p->skip) // end of a frame for another slave, back to listening
+    {
+        mbDiag[n].bus_msg++;
+        mbDiag[n].foreign++;
+        p->skip = 0;
+        p->state = MB_IDLE;
+        return false;
+    }
+    if (p->state != MB_RECEIVING)
+        return false;
+    p->state = MB_PROCESSING;
+    return true;
+}
+
+// parse the frame of the port and send the answer from the frame buffer, if there is one
+static void ModBusAnswer(uint8_t n)
+{
+    ModBusPort_t *p = &mb_port[n];
+    mbDiag_t *d = &mbDiag[n];
+    uint16_t count = ModBusParse(p);
+
+    d->parse_done = ModBusTime();
+    if (count)
+    {
+        p->count = count;
+        p->pos = 0;
+        p->state = MB_SENDING;
+        d->rx_end = p->rx_end;
+        d->tx_start = ModBusTime();
+        ModBusTxStart(n);
+        ModBusLatency(d);
+    }
+    else // no answer, back to receiving
+    {
+        portENTER_CRITICAL();
+        ModBusIdle(p);
+        portEXIT_CRITICAL();
+    }
+}
+
+// next byte of the answer, -1 once all are out
+static int16_t ModBusUdre(uint8_t n, uint8_t *woken)
+{
+    ModBusPort_t *p = &mb_port[n];
+
+    if (p->pos >= p->count)
+        return -1; // last byte in the shift register, TXC ends the answer
+    return p->buf[p->pos++];
+}
+
+// the last byte has left, the port listens again
+static void ModBusTxc(uint8_t n)
+{
+#if defined(__AVR__)
+    if (mb_hw[n].de)
+        GPCLEAR(mb_hw[n].de); // release the line
+#endif
+    ModBusIdle(&mb_port[n]);
+}
+
+#if defined(__AVR__)
+
+static TaskHandle_t ModBusTaskHandle; // one task serves the slave ports, notified by port bits
+
+static void TaskModBus(void *argument)
+{
+    uint32_t ready;
+    uint8_t n;
+
     for (;;)
     {
-        osEvent evt = osMessageGet(ModBusInHandle, ModBus35);
-        // Frame end?
-        if (evt.status == osEventTimeout)
-        {
-            if (mb_buf_in_count > 0) // ok, something in buffer exist, lets parse it
-            {
-                ModBusParse();
-            }
-            mb_buf_in_count = 0;
-        }
-        // Wow, something come!
-        if (evt.status == osEventMessage)
-        {
-            uint8_t byte = (uint8_t)evt.value.v;
-            // buffer has space for incoming?
-            if (mb_buf_in_count < 254)
-            {
-                mb_buf_in[mb_buf_in_count] = byte;
-                mb_buf_in_count = mb_buf_in_count + 1; // prevent opt/war on come compilers
-            }
-            else // oops, bad frame, by standard we should drop it and no answer
-            {
-                mb_buf_in_count = 0;
-            }
-        }
+        // Frame end, signalled by the compare ISR of the port
+        xTaskNotifyWait(0, 0xFFFFFFFFUL, &ready, portMAX_DELAY);
+
+        for (n = 0; n < ModBusPorts; n++)
+            if (ready & _BV(n))
+                ModBusAnswer(n);
     }
 }
 
+// the UDRE handler sends the answer, the TXC handler releases the line after it
+static void ModBusTxStart(uint8_t n)
+{
+    if (mb_hw[n].de)
+        GPSET(mb_hw[n].de);
+    *mb_hw[n].ucsrb |= _BV(UDRIE1);
+}
+
+void ModBus_Init(uint8_t port, uint8_t addr, uint32_t baud, uint8_t access)
+{
+    if (ModBusTaskHandle == NULL)
+        xTaskCreate(TaskModBus, (const char *)"ModBus", 256, NULL, 1, &ModBusTaskHandle); // FC20 keeps its sub-requests on the stack
+    ModBus_Open(port, baud, ModBusTaskHandle);
+
+    mb_port[port].addr = addr;
+    mb_port[port].access = access;
+}
 
-void ModBus_Init(void)
+void ModBus_Open(uint8_t port, uint32_t baud, TaskHandle_t task)
 {
-    ModBusInHandle = xQueueCreate(256, sizeof(uint8_t));
-    ModBusOutHandle = xQueueCreate(256, sizeof(uint8_t));
-    xTaskCreate(TaskModBus, (const char *)"ModBus", 128, NULL, 1, ModBusTaskHandle);
+    const ModBusHw_t *hw = &mb_hw[port];
 
-    mb_buf_in_count = 0;
-    mb_addr = 247; // by default maximum possible adrress
-    mb_buf_out_count = 0;
-    for (int i = 0; i < ModBusRegisters; i++)
+    mb_port[port].count = 0;
+    mb_port[port].state = MB_IDLE;
+    mb_port[port].task = task;
+    mb_port[port].addr = 0;
+    mb_port[port].access = MB_RW;
+
+    if (hw->de)
     {
-        mb_reg[i] = 0;
+        GPOUTPUT(hw->de);
+        GPCLEAR(hw->de); // receive
     }
+
+    if ((TCCR3B & (_BV(CS32) | _BV(CS31) | _BV(CS30))) == 0)
+        TCCR3B |= _BV(CS30); // Timer3 free running at clk/1, shared with the period measurement
+
+    usartAttach(port, &ModBusUsart);
+    ModBus_SetBaud(port, baud);
+    *hw->ucsra = _BV(U2X1);                 // double speed mode
+    *hw->ucsrc = _BV(UCSZ11) | _BV(UCSZ10); // 8N1
+    *hw->ucsrb = _BV(RXCIE1) | _BV(TXCIE1) | _BV(RXEN1) | _BV(TXEN1);
 }
 
-void ModBus_SetAddress(uint8_t addr)
+uint8_t *ModBus_Buffer(uint8_t port)
 {
-    mb_addr = addr;
+    return mb_port[port].buf;
 }
 
-void CRC16_OUT(void);
-uint8_t CRC16_IN(void);
+void ModBus_Send(uint8_t port, uint16_t len)
+{
+    ModBusPort_t *p = &mb_port[port];
+    uint16_t crc = crc16_update_block(CRC16_INIT, p->buf, len);
+
+    p->buf[len++] = crc & 0xFF;
+    p->buf[len++] = (crc >> 8) & 0xFF;
 
-// parse something in incoming buffer
-void ModBusParse(void)
+    // forget a late answer to the previous request
+    xTaskNotifyStateClear(NULL);
+    ulTaskNotifyValueClear(NULL, _BV(port));
+
+    portENTER_CRITICAL();
+    p->count = len;
+    p->pos = 0;
+    p->error = 0;
+    p->state = MB_SENDING; // TXC goes back to idle, ready for the answer
+    if (mb_hw[port].de)
+        GPSET(mb_hw[port].de);
+    *mb_hw[port].ucsrb |= _BV(UDRIE1);
+    portEXIT_CRITICAL();
+}
+
+uint16_t ModBus_Receive(uint8_t port, TickType_t timeout)
 {
-    if (mb_buf_in_count == 0) // call as by mistake on empty buffer?
+    ModBusPort_t *p = &mb_port[port];
+    uint32_t ready = 0;
+    uint16_t len = 0;
+
+    // the answer ends with T3.5 of silence, the compare ISR notifies us
+    if (xTaskNotifyWait(0, _BV(port), &ready, timeout) && (ready & _BV(port)))
     {
-        return;
+        if (!p->error && (p->count >= 4) && (p->crc == 0))
+            len = p->count - 2;
     }
 
-    if (mb_buf_in[0] != mb_addr) // its not our address!
+    portENTER_CRITICAL();
+    ModBusIdle(p);
+    portEXIT_CRITICAL();
+    return len;
+}
+
+void ModBus_SetAddress(uint8_t port, uint8_t addr)
+{
+    mb_port[port].addr = addr;
+}
+
+void ModBus_SetBaud(uint8_t port, uint32_t baud)
+{
+    uint32_t t35 = ModBusUsToCounts(ModBus35_US(baud));
+    uint32_t t15 = ModBusUsToCounts(ModBus15_US(baud));
+
+    if ((t35 & 0xFFFF) == 0) // the compare needs a non zero offset
+        t35++;
+
+    portENTER_CRITICAL();
+    mb_port[port].t35 = t35;
+    mb_port[port].t15 = (t15 > 0xFFFF) ? 0xFFFF : (uint16_t)t15;
+    *mb_hw[port].ubrrh = (uint8_t)(((F_CPU / 8 / baud) - 1) >> 8);
+    *mb_hw[port].ubrrl = (uint8_t)((F_CPU / 8 / baud) - 1);
+    portEXIT_CRITICAL();
+}
+
+// Receive handler of the usart.c driver core, it reads UDRn. ModBusUdre() and ModBusTxc() send.
+
+static void ModBusRx(uint8_t n, uint8_t status, uint8_t data, uint8_t *woken)
+{
+    const ModBusHw_t *hw = &mb_hw[n];
+    ModBusPort_t *p = &mb_port[n];
+    uint16_t now = TCNT3;
+
+    if (p->state > MB_RECEIVING) // frame in process or answer in progress, drop it
+        return;
+
+    // T3.5 from now, the compare ISR ends the frame
+    *hw->ocr = now + (uint16_t)p->t35;
+    p->t35_wraps = (uint8_t)(p->t35 >> 16);
+    ETIFR = hw->ocie;
+    ETIMSK |= hw->ocie;
+
+    ModBusRxByte(p, status, data, now);
+}
+
+// T3.5 silence after the last byte, the frame is complete. Inlined with a constant port.
+static inline __attribute__((always_inline)) void ModBusT35ISR(uint8_t n)
+{
+    ModBusPort_t *p = &mb_port[n];
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    if (p->t35_wraps) // low baud rates, T3.5 is longer than one Timer3 period
     {
+        p->t35_wraps--;
         return;
     }
-    // check CRC
-    if (CRC16_IN() == 0)
+    ETIMSK &= ~mb_hw[n].ocie;
+
+    if (ModBusFrameEnd(n))
     {
-        mb_buf_out_count = 0;
-        uint16_t st, nu;
-        uint8_t func = mb_buf_in[1];
-        uint8_t i;
-        switch (func)
-        {
-        case 3:
-            // read holding registers. by bytes addr func starth startl totalh totall
-            st = mb_buf_in[2] * 256 + mb_buf_in[3];
-            nu = mb_buf_in[4] * 256 + mb_buf_in[5];
-            if ((st + nu) > ModBusRegisters) // dont ask more, that we has!
-            {
-                mb_buf_out[mb_buf_out_count++] = mb_addr;
-                mb_buf_out[mb_buf_out_count++] = func + 0x80;
-                mb_buf_out[mb_buf_out_count++] = 2;
-            }
-            else
-            {
-                mb_buf_out[mb_buf_out_count++] = mb_addr;
-                mb_buf_out[mb_buf_out_count++] = func;
-                mb_buf_out[mb_buf_out_count++] = nu * 2; // how many bytes we will send?
-                for (i = st; i < (st + nu); i++)
-                {
-                    mb_buf_out[mb_buf_out_count++] = (mb_reg[i] >> 8) & 0xFF; // hi part
-                    mb_buf_out[mb_buf_out_count++] = mb_reg[i] & 0xFF;        // lo part
-                }
-            }
-            break;
-        case 16:
-            // write holding registers. by bytes addr func starth startl totalh totall num_bytes regh regl ...
-            st = mb_buf_in[2] * 256 + mb_buf_in[3];
-            nu = mb_buf_in[4] * 256 + mb_buf_in[5];
-            if ((st + nu) > ModBusRegisters) // dont ask more, that we has!
-            {
-                mb_buf_out[mb_buf_out_count++] = mb_addr;
-                mb_buf_out[mb_buf_out_count++] = func + 0x80;
-                mb_buf_out[mb_buf_out_count++] = 2;
-            }
-            else
-            { // ATTN : skip num_bytes
-                for (i = 0; i < nu; i++)
-                {
-                    mb_reg[st + i] = mb_buf_in[7 + i * 2] * 256 + mb_buf_in[8 + i * 2];
-                }
-                mb_buf_out[mb_buf_out_count++] = mb_addr;
-                mb_buf_out[mb_buf_out_count++] = func;
-                mb_buf_out[mb_buf_out_count++] = mb_buf_in[2]; // how many registers ask, so many wrote
-                mb_buf_out[mb_buf_out_count++] = mb_buf_in[3];
-                mb_buf_out[mb_buf_out_count++] = mb_buf_in[4];
-                mb_buf_out[mb_buf_out_count++] = mb_buf_in[5];
-            }
-            break;
-        default:
-            // Exception as we does not provide this function
-            mb_buf_out[mb_buf_out_count++] = mb_addr;
-            mb_buf_out[mb_buf_out_count++] = func + 0x80;
-            mb_buf_out[mb_buf_out_count++] = 1;
-            break;
-        }
+        // the compare matched T3.5 after the last byte, the ISR latency is the count since
+        p->rx_end = ModBusTime() - p->t35 - (uint16_t)(TCNT3 - *mb_hw[n].ocr);
+        if (p->task != NULL)
+            xTaskNotifyFromISR(p->task, _BV(n), eSetBits, &xHigherPriorityTaskWoken);
+        if (xHigherPriorityTaskWoken)
+            taskYIELD(); // answer without waiting for the next tick
+    }
+}
 
-        CRC16_OUT();
+// the compares only fire on a port ModBus_Open() has attached
+ISR(TIMER3_COMPC_vect)
+{
+    ModBusT35ISR(0);
+}
 
-        // If you want directly to USB-CDC
-        // CDC_Transmit_FS(&mb_buf_out[0], mb_buf_out_count);
-        for (int i = 0; i < mb_buf_out_count; i++)
-        {
-            osMessagePut(ModBusOutHandle, mb_buf_out[i], 0);
-        }
+ISR(TIMER3_COMPB_vect)
+{
+    ModBusT35ISR(1);
+}
+
+#else // host build, the line is a pseudo terminal
+
+static int mb_fd[ModBusPorts] = {-1, -1};
+static uint32_t mb_baud[ModBusPorts];
+
+const char *ModBus_HostOpen(uint8_t port, uint8_t addr, uint32_t baud, uint8_t access)
+{
+    struct termios tio;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if ((fd < 0) || grantpt(fd) || unlockpt(fd))
+        return NULL;
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio); // binary frames, no echo
+        tcsetattr(fd, TCSANOW, &tio);
     }
-    // Ok, we parsed buffer, clean up
-    mb_buf_in_count = 0;
-    mb_buf_out_count = 0;
+
+    mb_fd[port] = fd;
+    ModBusIdle(&mb_port[port]);
+    mb_port[port].addr = addr;
+    mb_port[port].access = access;
+    ModBus_SetBaud(port, baud);
+    return ptsname(fd);
+}
+
+void ModBus_SetAddress(uint8_t port, uint8_t addr)
+{
+    mb_port[port].addr = addr;
+}
+
+// the line has no baud rate, it only sets T1.5, T3.5 and the time an answer takes
+void ModBus_SetBaud(uint8_t port, uint32_t baud)
+{
+    uint32_t t15 = ModBusUsToCounts(ModBus15_US(baud));
+
+    mb_baud[port] = baud;
+    mb_port[port].t35 = ModBusUsToCounts(ModBus35_US(baud));
+    mb_port[port].t15 = (t15 > 0xFFFF) ? 0xFFFF : (uint16_t)t15;
+}
+
+// wait up to us for more bytes. Those already queued came back to back, whenever this thread
+// gets to read them, so they are taken in one read and share its time.
+static uint16_t ModBusHostRead(int fd, uint32_t us, uint8_t *data, uint16_t size)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    ssize_t n;
+
+    if (poll(&pfd, 1, (us + 999) / 1000) <= 0)
+        return 0;
+    n = read(fd, data, size);
+    return (n > 0) ? (uint16_t)n : 0;
 }
 
-// set value of register
-void ModBus_SetRegister(uint8_t reg, uint16_t value)
+// the UDRE handler hands the whole answer over, it reaches the master after its time on
+// the line, 11 bits a byte, then the transmit complete handler ends it
+static void ModBusTxStart(uint8_t n)
 {
-    if (reg < ModBusRegisters)
+    uint8_t out[ModBusFrameSize];
+    uint16_t len = 0;
+    uint8_t woken = 0;
+    int16_t data;
+
+    usleep((uint64_t)mb_port[n].count * 11000000UL / mb_baud[n]);
+    while ((data = ModBusUdre(n, &woken)) >= 0)
+        out[len++] = (uint8_t)data;
+    if (write(mb_fd[n], out, len) != len)
+        return; // the client has gone
+    ModBusTxc(n);
+}
+
+bool ModBus_HostServe(uint8_t port, uint32_t timeout_ms)
+{
+    ModBusPort_t *p = &mb_port[port];
+    uint8_t data[ModBusFrameSize];
+    uint32_t now;
+    uint16_t n, i;
+
+    n = ModBusHostRead(mb_fd[port], timeout_ms * 1000, data, sizeof(data));
+    if (!n)
+        return false;
+
+    do
     {
-        mb_reg[reg] = value;
+        now = ModBusTime();
+        for (i = 0; i < n; i++)
+            ModBusRxByte(p, 0, data[i], (uint16_t)now);
+    } while ((n = ModBusHostRead(mb_fd[port], p->t35, data, sizeof(data)))); // frame ends with T3.5 of silence
+
+    if (ModBusFrameEnd(port))
+    {
+        p->rx_end = now;
+        ModBusAnswer(port);
     }
+    return true;
 }
-// grab value of register
-uint16_t ModBus_GetRegister(uint8_t reg)
+
+#endif // __AVR__
+
+// Read File Record (FC20). The answer overlaps the request, so the sub-requests
+// are taken aside first; the records then go out in one frame as large as allowed.
+static uint8_t ModBusFileRead(uint8_t *buf, uint16_t count, uint16_t *len)
 {
-    if (reg < ModBusRegisters)
+    uint16_t file[ModBusFileRequests];
+    uint16_t record[ModBusFileRequests];
+    uint8_t size[ModBusFileRequests];
+    uint8_t bytes = buf[2];
+    uint8_t n = bytes / 7;
+    uint16_t out = 3;
+    uint8_t *q;
+    uint8_t i, ex;
+
+    if ((bytes < 7) || (bytes > 0xF5) || (bytes % 7) || (count != 5 + bytes) || (n > ModBusFileRequests))
+        return MB_EX_ILLEGAL_VALUE;
+
+    for (i = 0, q = &buf[3]; i < n; i++, q += 7)
     {
-        return mb_reg[reg];
+        file[i] = q[1] * 256 + q[2];
+        record[i] = q[3] * 256 + q[4];
+        if ((q[0] != 6) || (q[5] != 0) || (q[6] == 0) || (record[i] > 0x270F))
+            return MB_EX_ILLEGAL_VALUE;
+        size[i] = q[6];
+        out += 2 + size[i] * 2;
+        ex = mbFileCheck(&mbFileMap, file[i], record[i], size[i], MB_RO);
+        if (ex != MB_EX_NONE)
+            return ex;
     }
-    return 0;
+    if (out > ModBusFrameSize - 2) // address and PDU of up to 253 bytes
+        return MB_EX_ILLEGAL_VALUE;
+
+    buf[2] = out - 3;
+    for (i = 0, out = 3; i < n; i++)
+    {
+        buf[out++] = 1 + size[i] * 2;
+        buf[out++] = 6;
+        mbFileRead(&mbFileMap, file[i], record[i], size[i], &buf[out]);
+        out += size[i] * 2;
+    }
+    *len = out;
+    return MB_EX_NONE;
+}
+
+// Write File Record (FC21), all sub-requests are checked before any is written.
+// The answer is the echo of the request.
+static uint8_t ModBusFileWrite(uint8_t *buf, uint16_t count, uint16_t *len)
+{
+    uint8_t bytes = buf[2];
+    uint8_t *q;
+    uint8_t *end = &buf[3 + bytes];
+    uint16_t record, size;
+    uint8_t ex;
+
+    if ((bytes < 9) || (bytes > 0xFB) || (count != 5 + bytes))
+        return MB_EX_ILLEGAL_VALUE;
+
+    for (q = &buf[3]; q < end; q += 7 + size * 2)
+    {
+        if (end - q < 9)
+            return MB_EX_ILLEGAL_VALUE;
+        record = q[3] * 256 + q[4];
+        size = q[5] * 256 + q[6];
+        if ((q[0] != 6) || (size == 0) || (record > 0x270F) || (q + 7 + size * 2 > end))
+            return MB_EX_ILLEGAL_VALUE;
+        ex = mbFileCheck(&mbFileMap, q[1] * 256 + q[2], record, size, MB_WO);
+        if (ex != MB_EX_NONE)
+            return ex;
+    }
+
+    for (q = &buf[3]; q < end; q += 7 + size * 2)
+    {
+        size = q[5] * 256 + q[6];
+        mbFileWrite(&mbFileMap, q[1] * 256 + q[2], q[3] * 256 + q[4], size, &q[7]);
+    }
+    *len = count - 2;
+    return MB_EX_NONE;
+}
+
+// Diagnostics (FC08), the answer is the request with the counter in the data field
+static uint8_t ModBusDiagnostics(mbDiag_t *d, uint8_t *buf, uint16_t count, uint16_t *len)
+{
+    uint16_t sub = buf[2] * 256 + buf[3];
+    uint16_t value;
+
+    if (sub == 0x00) // return query data, any length
+    {
+        *len = count - 2;
+        return MB_EX_NONE;
+    }
+    if (count != 8)
+        return MB_EX_ILLEGAL_VALUE;
+
+    switch (sub)
+    {
+    case 0x01: // restart communications option
+    case 0x0A: // clear counters and diagnostic register, the turnaround statistics stay
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // bus_msg and foreign are counted by the receive ISR too
+        {
+            d->bus_msg = 0;
+            d->foreign = 0;
+        }
+        d->crc_err = 0;
+        d->exceptions = 0;
+        d->server_msg = 0;
+        d->no_resp = 0;
+        d->overrun = 0;
+        *len = 6;
+        return MB_EX_NONE;
+    case 0x0B: // bus message count
+        value = d->bus_msg;
+        break;
+    case 0x0C: // bus communication error count
+        value = d->crc_err;
+        break;
+    case 0x0D: // bus exception error count
+        value = d->exceptions;
+        break;
+    case 0x0E: // server message count
+        value = d->server_msg;
+        break;
+    case 0x0F: // server no response count
+        value = d->no_resp;
+        break;
+    case 0x10: // server NAK count
+    case 0x11: // server busy count
+        value = 0;
+        break;
+    case 0x12: // bus character overrun count
+        value = d->overrun;
+        break;
+    default:
+        return MB_EX_ILLEGAL_FUNCTION;
+    }
+    buf[4] = value >> 8;
+    buf[5] = value & 0xFF;
+    *len = 6;
+    return MB_EX_NONE;
 }
 
-// Calculate CRC for outcoming buffer
-// and place it to end.
-void CRC16_OUT(void)
+// Read Device Identification (FC43, MEI type 14), answer built in place.
+// by bytes addr func mei code object_id
+static uint8_t ModBusDeviceId(uint8_t *buf, uint16_t count, uint16_t *len)
 {
-    uint16_t crc = 0xFFFF;
-    uint16_t pos = 0;
-    uint8_t i = 0;
-    uint8_t lo = 0;
-    uint8_t hi = 0;
+    uint8_t code = buf[3];
+    uint8_t id = buf[4];
+    uint8_t last, size, n = 0;
+    uint8_t more = 0, next = 0;
+    uint16_t out = 8; // objects follow addr func mei code conformity more next count
+    int16_t room;
 
-    for (pos = 0; pos < mb_buf_out_count; pos++)
+    if (buf[2] != 0x0E) // only the device identification MEI type
+        return MB_EX_ILLEGAL_FUNCTION;
+    if (count != 7)
+        return MB_EX_ILLEGAL_VALUE;
+
+    switch (code)
     {
-        crc ^= mb_buf_out[pos];
+    case 1: // basic, stream access
+        last = MB_OBJ_REVISION;
+        break;
+    case 2: // regular, stream access
+        last = 0x7F;
+        break;
+    case 3: // extended, stream access
+        last = 0xFF;
+        break;
+    case 4: // one specific object
+        if (mbDeviceObject(id, NULL, 0) == 0)
+            return MB_EX_ILLEGAL_ADDRESS;
+        last = id;
+        break;
+    default:
+        return MB_EX_ILLEGAL_VALUE;
+    }
+    if (id > last) // by standard, an object id out of the category restarts from 0
+        id = 0;
 
-        for (i = 8; i != 0; i--)
+    for (;;)
+    {
+        room = ModBusFrameSize - 2 - (out + 2); // keep the CRC
+        size = mbDeviceObject(id, &buf[out + 2], (room > 0) ? room : 0);
+        if (size)
         {
-            if ((crc & 0x0001) != 0)
+            if (size > room) // does not fit, the master asks for the rest
             {
-                crc >>= 1;
-                crc ^= 0xA001;
+                more = 0xFF;
+                next = id;
+                break;
             }
-            else
-                crc >>= 1;
+            buf[out] = id;
+            buf[out + 1] = size;
+            out += 2 + size;
+            n++;
         }
+        if (id == last)
+            break;
+        id++;
     }
-    lo = crc & 0xFF;
-    hi = (crc >> 8) & 0xFF;
 
-    mb_buf_out[mb_buf_out_count++] = lo;
-    mb_buf_out[mb_buf_out_count++] = hi;
+    buf[4] = 0x83; // conformity level: extended, stream and individual access
+    buf[5] = more;
+    buf[6] = next;
+    buf[7] = n;
+    *len = out;
+    return MB_EX_NONE;
 }
 
-// Calculate CRC fro incoming buffer
-// Return 0 - if CRC is correct, overwise return 0
-uint8_t CRC16_IN(void)
+// parse the frame in the buffer and build the answer in place.
+// Return the answer length with CRC, 0 if there is nothing to send.
+static uint16_t ModBusParse(ModBusPort_t *p)
 {
-    uint16_t crc = 0xFFFF;
-    uint16_t pos = 0;
-    uint8_t i = 0;
-    uint8_t lo = 0;
-    uint8_t hi = 0;
+    mbDiag_t *d = &mbDiag[p - mb_port];
+    uint8_t *buf = p->buf;
+    uint16_t count = p->count;
+    uint16_t st, nu, wst, wnu, crc;
+    uint8_t func;
+    uint8_t ex;
+    uint8_t on;
+    uint16_t out = 0;
 
-    for (pos = 0; pos < mb_buf_in_count - 2; pos++)
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        crc ^= mb_buf_in[pos];
+        d->bus_msg++; // also counted by the receive ISR for foreign frames
+    }
+    if (p->error & MB_ERR_OVERRUN)
+        d->overrun++;
+    if (p->error || (count < 4)) // broken or too short, no answer
+    {
+        d->crc_err++;
+        return 0;
+    }
+
+    // check CRC, folded in byte by byte by the receive ISR
+    if (p->crc != 0)
+    {
+        d->crc_err++;
+        return 0;
+    }
 
-        for (i = 8; i != 0; i--)
+    if ((buf[0] != p->addr) && (buf[0] != 0)) // its not our address! normally dropped by the receive ISR already
+    {
+        d->foreign++;
+        return 0;
+    }
+    d->server_msg++;
+
+    func = buf[1];
+    st = buf[2] * 256 + buf[3];
+    nu = buf[4] * 256 + buf[5];
+    if (!(p->access & MB_WO) && ((func == 5) || (func == 6) || (func == 15) || (func == 16) || (func == 21) || (func == 23)))
+        func = 0; // read only port, refused as an unsupported function
+    switch (func)
+    {
+    case 1:
+    case 2:
+        // read coils or discrete inputs. by bytes addr func starth startl totalh totall
+        if ((count != 8) || (nu == 0) || (nu > 2000))
+            ex = MB_EX_ILLEGAL_VALUE;
+        else
+            ex = mbBitRead((func == 1) ? &mbCoilMap : &mbDiscreteMap, st, nu, &buf[3]);
+        if (ex == MB_EX_NONE)
         {
-            if ((crc & 0x0001) != 0)
-            {
-                crc >>= 1;
-                crc ^= 0xA001;
-            }
-            else
-                crc >>= 1;
+            buf[2] = (nu + 7) / 8;
+            out = 3 + buf[2];
+        }
+        break;
+    case 3:
+    case 4:
+        // read holding or input registers. by bytes addr func starth startl totalh totall
+        if ((count != 8) || (nu == 0) || (nu > 125))
+            ex = MB_EX_ILLEGAL_VALUE;
+        else // serialized straight from the variables of the register map
+            ex = mbRegRead((func == 3) ? &mbHoldingMap : &mbInputMap, st, nu, &buf[3]);
+        if (ex == MB_EX_NONE)
+        {
+            buf[2] = nu * 2; // how many bytes we will send?
+            out = 3 + nu * 2;
+        }
+        break;
+    case 5:
+        // write single coil. by bytes addr func addrh addrl valueh valuel, value 0xFF00 is on, 0x0000 is off
+        if ((count != 8) || ((nu != 0xFF00) && (nu != 0x0000)))
+            ex = MB_EX_ILLEGAL_VALUE;
+        else
+        {
+            on = (nu != 0);
+            ex = mbBitWrite(&mbCoilMap, st, 1, &on);
+        }
+        if (ex == MB_EX_NONE)
+            out = 6; // echo of the request
+        break;
+    case 6:
+        // write single register. by bytes addr func addrh addrl valueh valuel
+        if (count != 8)
+            ex = MB_EX_ILLEGAL_VALUE;
+        else
+            ex = mbRegWrite(&mbHoldingMap, st, 1, &buf[4]);
+        if (ex == MB_EX_NONE)
+            out = 6; // echo of the request
+        break;
+    case 15:
+        // write multiple coils. by bytes addr func starth startl totalh totall num_bytes bits ...
+        if ((nu == 0) || (nu > 1968) || (buf[6] != (nu + 7) / 8) || (count != 9 + buf[6]))
+            ex = MB_EX_ILLEGAL_VALUE;
+        else
+            ex = mbBitWrite(&mbCoilMap, st, nu, &buf[7]);
+        if (ex == MB_EX_NONE)
+            out = 6;
+        break;
+    case 16:
+        // write holding registers. by bytes addr func starth startl totalh totall num_bytes regh regl ...
+        if ((nu == 0) || (nu > 123) || (buf[6] != nu * 2) || (count != 9 + nu * 2))
+            ex = MB_EX_ILLEGAL_VALUE;
+        else
+            ex = mbRegWrite(&mbHoldingMap, st, nu, &buf[7]);
+        if (ex == MB_EX_NONE)
+            out = 6; // addr func starth startl totalh totall are already in place
+        break;
+    case 20:
+        // read file record. by bytes addr func num_bytes [6 fileh filel recordh recordl lenh lenl] ...
+        ex = ModBusFileRead(buf, count, &out);
+        break;
+    case 21:
+        // write file record. by bytes addr func num_bytes [6 fileh filel recordh recordl lenh lenl data ...] ...
+        ex = ModBusFileWrite(buf, count, &out);
+        break;
+    case 23:
+        // read/write holding registers, the write goes first.
+        // by bytes addr func rstarth rstartl rtotalh rtotall wstarth wstartl wtotalh wtotall num_bytes regh regl ...
+        wst = buf[6] * 256 + buf[7];
+        wnu = buf[8] * 256 + buf[9];
+        if ((nu == 0) || (nu > 125) || (wnu == 0) || (wnu > 121) || (buf[10] != wnu * 2) || (count != 13 + wnu * 2))
+            ex = MB_EX_ILLEGAL_VALUE;
+        else
+        {
+            ex = mbRegWrite(&mbHoldingMap, wst, wnu, &buf[11]);
+            if (ex == MB_EX_NONE)
+                ex = mbRegRead(&mbHoldingMap, st, nu, &buf[3]);
         }
+        if (ex == MB_EX_NONE)
+        {
+            buf[2] = nu * 2;
+            out = 3 + nu * 2;
+        }
+        break;
+    case 8:
+        // diagnostics. by bytes addr func subh subl datah datal
+        ex = ModBusDiagnostics(d, buf, count, &out);
+        break;
+    case 43:
+        // read device identification
+        ex = ModBusDeviceId(buf, count, &out);
+        break;
+    default:
+        // Exception as we does not provide this function
+        ex = MB_EX_ILLEGAL_FUNCTION;
+        break;
     }
-    lo = crc & 0xFF;
-    hi = (crc >> 8) & 0xFF;
-    if ((mb_buf_in[mb_buf_in_count - 2] == lo) &&
-        (mb_buf_in[mb_buf_in_count - 1] == hi))
+
+    if (ex != MB_EX_NONE)
     {
+        d->exceptions++;
+        buf[1] |= 0x80; // the function of the request, even when refused
+        buf[2] = ex;
+        out = 3;
+    }
+
+    if (buf[0] == 0) // broadcast, writes are done but never answered
+    {
+        d->no_resp++;
         return 0;
     }
-    return 1;
+
+    crc = crc16_update_block(CRC16_INIT, buf, out);
+    buf[out++] = crc & 0xFF;
+    buf[out++] = (crc >> 8) & 0xFF;
+    return out;
 }
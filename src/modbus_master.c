@@ -0,0 +1,138 @@
+/**
+Modbus RTU master, polls the downstream devices of a schedule table.
+
+The requests go out back to back: the next one is sent as soon as the answer to
+the previous one has ended (T3.5 after its last byte), so the line stays busy
+as long as polls are due. Values land in mbPollData, served by the register map.
+**/
+
+#if defined(__AVR__) // uses the USART engine of modbus.c, not in the host build
+
+#include <stdbool.h>
+#include <avr/io.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "modbus.h"
+
+volatile uint32_t mbPollData[ModBusPollValues];
+volatile uint16_t mbPollValid;
+
+static const __flash mbPollSchedule_t *mb_schedule;
+static uint8_t mb_master_port;
+static uint32_t mb_master_baud;
+static TickType_t mb_last_poll[ModBusPollLines];
+
+// time to wait for the answer: both frames on the line plus the turnaround of the device
+static TickType_t ModBusMasterTimeout(uint16_t request, uint16_t answer)
+{
+    uint32_t ms = ((uint32_t)(request + answer) * 11000UL + mb_master_baud - 1) / mb_master_baud;
+
+    return pdMS_TO_TICKS(ms + ModBusMasterTimeoutMs) + 1;
+}
+
+// whole 32 bit values that fit in mbPollData and in one answer
+static bool ModBusMasterValid(const __flash mbPoll_t *poll)
+{
+    if ((poll->count == 0) || (poll->count > 124) || (poll->count & 1))
+        return false;
+    return poll->dest + poll->count / 2 <= ModBusPollValues;
+}
+
+// one poll with retries, true when the values are stored
+static bool ModBusMasterPoll(const __flash mbPoll_t *poll)
+{
+    uint8_t *buf = ModBus_Buffer(mb_master_port);
+    uint16_t len;
+    uint32_t value;
+    uint8_t retry, i;
+
+    for (retry = 0; retry <= ModBusMasterRetries; retry++)
+    {
+        buf[0] = poll->slave;
+        buf[1] = poll->func;
+        buf[2] = poll->start >> 8;
+        buf[3] = poll->start & 0xFF;
+        buf[4] = 0;
+        buf[5] = poll->count;
+        ModBus_Send(mb_master_port, 6);
+
+        len = ModBus_Receive(mb_master_port, ModBusMasterTimeout(8, 5 + poll->count * 2));
+        if ((len == 3 + poll->count * 2) && (buf[0] == poll->slave) && (buf[1] == poll->func) && (buf[2] == poll->count * 2))
+        {
+            for (i = 0; i < poll->count / 2; i++)
+            {
+                value = ((uint32_t)buf[3 + i * 4] << 24) | ((uint32_t)buf[4 + i * 4] << 16) | ((uint16_t)buf[5 + i * 4] << 8) | buf[6 + i * 4];
+                portENTER_CRITICAL();
+                mbPollData[poll->dest + i] = value;
+                portEXIT_CRITICAL();
+            }
+            return true;
+        }
+        if ((len == 3) && (buf[0] == poll->slave) && (buf[1] == (poll->func | 0x80)))
+            return false; // exception, asking again does not help
+    }
+    return false;
+}
+
+static void TaskModBusMaster(void *argument)
+{
+    const __flash mbPoll_t *poll;
+    TickType_t now;
+    bool busy;
+    uint8_t n;
+
+    for (;;)
+    {
+        busy = false;
+        for (n = 0; n < mb_schedule->count; n++)
+        {
+            poll = &mb_schedule->polls[n];
+            now = xTaskGetTickCount();
+            if ((now - mb_last_poll[n]) < pdMS_TO_TICKS(poll->period))
+                continue;
+            mb_last_poll[n] = now;
+            busy = true;
+
+            if (ModBusMasterPoll(poll))
+            {
+                portENTER_CRITICAL();
+                mbPollValid |= (uint16_t)1u << n;
+                portEXIT_CRITICAL();
+            }
+            else
+            {
+                portENTER_CRITICAL();
+                mbPollValid &= ~((uint16_t)1u << n);
+                portEXIT_CRITICAL();
+            }
+        }
+        if (!busy) // nothing due, give the line a tick
+            vTaskDelay(1);
+    }
+}
+
+bool ModBus_InitMaster(uint8_t port, uint32_t baud, const __flash mbPollSchedule_t *schedule)
+{
+    TaskHandle_t task;
+    uint8_t n;
+
+    if (schedule->count > ModBusPollLines)
+        return false;
+    for (n = 0; n < schedule->count; n++)
+        if (!ModBusMasterValid(&schedule->polls[n]))
+            return false;
+
+    mb_schedule = schedule;
+    mb_master_port = port;
+    mb_master_baud = baud;
+    for (n = 0; n < schedule->count; n++)
+        mb_last_poll[n] = (TickType_t)0 - pdMS_TO_TICKS(schedule->polls[n].period); // all due at start
+
+    xTaskCreate(TaskModBusMaster, (const char *)"ModBusM", 128, NULL, 1, &task);
+    ModBus_Open(port, baud, task);
+    return true;
+}
+
+#endif // __AVR__
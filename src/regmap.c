@@ -0,0 +1,199 @@
+// Modbus register map of the totalizer
+
+#include <stdlib.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+
+#include "FreeRTOS.h"
+
+#include "totalizer.h"
+#include "board.h"
+#include "mbregmap.h"
+#include "modbus.h"
+#include "serial.h"
+#include "ver.h"
+
+EEMEM uint32_t ee_serial; // individual number of the meter, assigned at commissioning
+EEMEM float ee_kfactor[16];  // calibration: up to 8 points of frequency and K-factor, linear in between
+
+// counters can only be reset
+static bool validateReset(const void *value)
+{
+    return *(const uint32_t *)value == 0;
+}
+
+// mean period of channel 0 in us, from the sum of Timer3 counts
+static void getMeanPeriod(void *value)
+{
+    uint32_t period, pulses;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        period = g_period;
+        pulses = g_pulses0;
+    }
+    *(float *)value = pulses ? (float)period / pulses / (F_CPU / 1000000UL) : 0.0f;
+}
+
+// sum of all channels
+static void getGrandTotal(void *value)
+{
+    uint32_t p0, p1, p2;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        p0 = g_pulses0;
+        p1 = g_pulses1;
+        p2 = g_pulses2;
+    }
+    *(int64_t *)value = (int64_t)p0 + p1 + p2;
+}
+
+// holding registers, sorted by address
+static const __flash mbReg_t holdingRegs[] = {
+    MBREG_U32(0, g_pulses0, MB_RW, validateReset), // channel 0 pulses (INT7)
+    MBREG_U32(2, g_pulses1, MB_RW, validateReset), // channel 1 pulses (analog comparator)
+    MBREG_U32(4, g_pulses2, MB_RW, validateReset), // channel 2 pulses (INT6)
+    MBREG_U32(6, g_period, MB_RO, NULL),           // channel 0 sum of periods, Timer3 counts
+    MBREG_GET(8, MB_FLOAT, MB_RO, getMeanPeriod),  // channel 0 mean period, us
+    MBREG_GET(10, MB_I64, MB_RO, getGrandTotal),   // all channels pulses
+};
+
+// diagnostics of a Modbus port, from base: counters, timestamps of the last
+// answered frame (Timer3 counts), turnaround min/avg/max/count in us, histogram
+#define DIAG_REGS(base, n)                                    \
+    MBREG_U16((base) + 0, mbDiag[n].bus_msg, MB_RO, NULL),    \
+    MBREG_U16((base) + 1, mbDiag[n].crc_err, MB_RO, NULL),    \
+    MBREG_U16((base) + 2, mbDiag[n].exceptions, MB_RO, NULL), \
+    MBREG_U16((base) + 3, mbDiag[n].server_msg, MB_RO, NULL), \
+    MBREG_U16((base) + 4, mbDiag[n].no_resp, MB_RO, NULL),    \
+    MBREG_U16((base) + 5, mbDiag[n].overrun, MB_RO, NULL),    \
+    MBREG_U16((base) + 6, mbDiag[n].foreign, MB_RO, NULL),    \
+    MBREG_U32((base) + 7, mbDiag[n].rx_end, MB_RO, NULL),     \
+    MBREG_U32((base) + 9, mbDiag[n].parse_done, MB_RO, NULL), \
+    MBREG_U32((base) + 11, mbDiag[n].tx_start, MB_RO, NULL),  \
+    MBREG_U16((base) + 13, mbDiag[n].lat_min, MB_RO, NULL),   \
+    MBREG_U16((base) + 14, mbDiag[n].lat_avg, MB_RO, NULL),   \
+    MBREG_U16((base) + 15, mbDiag[n].lat_max, MB_RO, NULL),   \
+    MBREG_U16((base) + 16, mbDiag[n].lat_count, MB_RO, NULL), \
+    MBREG_U16((base) + 17, mbDiag[n].hist[0], MB_RO, NULL),   \
+    MBREG_U16((base) + 18, mbDiag[n].hist[1], MB_RO, NULL),   \
+    MBREG_U16((base) + 19, mbDiag[n].hist[2], MB_RO, NULL),   \
+    MBREG_U16((base) + 20, mbDiag[n].hist[3], MB_RO, NULL),   \
+    MBREG_U16((base) + 21, mbDiag[n].hist[4], MB_RO, NULL),   \
+    MBREG_U16((base) + 22, mbDiag[n].hist[5], MB_RO, NULL),   \
+    MBREG_U16((base) + 23, mbDiag[n].hist[6], MB_RO, NULL),   \
+    MBREG_U16((base) + 24, mbDiag[n].hist[7], MB_RO, NULL)
+
+// error and buffer statistics of a serial driver port, from base
+#define SERIAL_REGS(base, port)                                    \
+    MBREG_U16((base) + 0, (port).stats.frameErrors, MB_RO, NULL),  \
+    MBREG_U16((base) + 1, (port).stats.overruns, MB_RO, NULL),     \
+    MBREG_U16((base) + 2, (port).stats.parityErrors, MB_RO, NULL), \
+    MBREG_U16((base) + 3, (port).stats.rxDrops, MB_RO, NULL),      \
+    MBREG_U16((base) + 4, (port).stats.rxHighWater, MB_RO, NULL),  \
+    MBREG_U16((base) + 5, (port).stats.txHighWater, MB_RO, NULL)
+
+// input registers, the measurements only
+static const __flash mbReg_t inputRegs[] = {
+    MBREG_U32(0, g_pulses0, MB_RO, NULL),
+    MBREG_U32(2, g_pulses1, MB_RO, NULL),
+    MBREG_U32(4, g_pulses2, MB_RO, NULL),
+    MBREG_U32(6, g_period, MB_RO, NULL),
+    MBREG_GET(8, MB_FLOAT, MB_RO, getMeanPeriod),
+    MBREG_GET(10, MB_I64, MB_RO, getGrandTotal),
+    MBREG_U32(100, mbPollData[0], MB_RO, NULL), // collected by the master, see mbPollSchedule
+    MBREG_U32(102, mbPollData[1], MB_RO, NULL),
+    MBREG_U32(104, mbPollData[2], MB_RO, NULL),
+    MBREG_U32(106, mbPollData[3], MB_RO, NULL),
+    MBREG_U32(108, mbPollData[4], MB_RO, NULL),
+    MBREG_U32(110, mbPollData[5], MB_RO, NULL),
+    MBREG_U32(112, mbPollData[6], MB_RO, NULL),
+    MBREG_U32(114, mbPollData[7], MB_RO, NULL),
+    MBREG_U16(116, mbPollValid, MB_RO, NULL), // bit per schedule line, last poll succeeded
+    DIAG_REGS(200, 0), // USART0
+    DIAG_REGS(230, 1), // USART1
+#if !defined(portMODBUS_USART0) // main.c opens the console, USART1 is never a serial.c port
+    SERIAL_REGS(260, xSerialPort), // serial.c USART0 console
+#endif
+};
+
+// coils, the outputs are active LOW
+static const __flash mbBit_t coilBits[] = {
+    MBBIT(0, DOUT0, MB_RW | MB_ACTIVE_LOW),
+    MBBIT(1, DOUT1, MB_RW | MB_ACTIVE_LOW),
+    MBBIT(2, DOUT2, MB_RW | MB_ACTIVE_LOW),
+};
+
+// discrete inputs, 1 when the input is active
+static const __flash mbBit_t discreteBits[] = {
+    MBBIT(0, COUNT1, MB_RO | MB_ACTIVE_LOW), // channel 0
+    MBBIT(1, COUNT2, MB_RO | MB_ACTIVE_LOW), // channel 1
+    MBBIT(2, TP7, MB_RO | MB_ACTIVE_LOW),    // channel 2
+    MBBIT(3, DI2, MB_RO | MB_ACTIVE_LOW),
+    MBBIT(4, SW0, MB_RO | MB_ACTIVE_LOW), // keys
+    MBBIT(5, SW1, MB_RO | MB_ACTIVE_LOW),
+    MBBIT(6, SW2, MB_RO | MB_ACTIVE_LOW),
+    MBBIT(7, SW3, MB_RO | MB_ACTIVE_LOW),
+};
+
+const __flash mbRegMap_t mbHoldingMap = {holdingRegs, sizeof(holdingRegs) / sizeof(holdingRegs[0])};
+const __flash mbRegMap_t mbInputMap = {inputRegs, sizeof(inputRegs) / sizeof(inputRegs[0])};
+const __flash mbBitMap_t mbCoilMap = {coilBits, sizeof(coilBits) / sizeof(coilBits[0])};
+const __flash mbBitMap_t mbDiscreteMap = {discreteBits, sizeof(discreteBits) / sizeof(discreteBits[0])};
+
+// files served by FC20/FC21, streamed straight from the EEPROM
+static const __flash mbFile_t files[] = {
+    {1, MB_RO, (uint8_t *)0, (E2END + 1) / 2},                      // configuration, the whole EEPROM
+    {2, MB_RW, (uint8_t *)ee_kfactor, sizeof(ee_kfactor) / 2}, // calibration, K-factor curve
+};
+
+const __flash mbFileMap_t mbFileMap = {files, sizeof(files) / sizeof(files[0])};
+
+// downstream pulse meters polled in concentrator mode (portMODBUS_MASTER):
+// channel 0 and 1 totals of the secondary meters at addresses 1 and 2, every second
+static const __flash mbPoll_t polls[] = {
+    {1, 3, 0, 4, 1000, 0},
+    {2, 3, 0, 4, 1000, 2},
+};
+
+const __flash mbPollSchedule_t mbPollSchedule = {polls, sizeof(polls) / sizeof(polls[0])};
+
+static const __flash char idVendor[] = FW_VENDOR;
+static const __flash char idProduct[] = FW_PRODUCT;
+static const __flash char idRevision[] = FW_VERSION;
+
+uint8_t mbDeviceObject(uint8_t id, uint8_t *buf, uint8_t size)
+{
+    const __flash char *str;
+    char serial[11];
+    uint8_t len, i;
+
+    switch (id)
+    {
+    case MB_OBJ_VENDOR:
+        str = idVendor;
+        break;
+    case MB_OBJ_PRODUCT:
+        str = idProduct;
+        break;
+    case MB_OBJ_REVISION:
+        str = idRevision;
+        break;
+    case MB_OBJ_SERIAL:
+        ultoa(eeprom_read_dword(&ee_serial), serial, 10);
+        len = strlen(serial);
+        memcpy(buf, serial, (len < size) ? len : size);
+        return len;
+    default:
+        return 0;
+    }
+
+    for (len = 0; str[len]; len++)
+    {
+        if (len < size)
+            buf[len] = str[len];
+    }
+    return len;
+}
@@ -43,7 +43,10 @@ THE POSSIBILITY OF SUCH DAMAGE.
 *************************************************************************/
 
 #include <avr/io.h>
+#include "FreeRTOS.h"
 #include "yaMBSiavr.h"
+#include "crc16.h"
+#include "usart.h"
 #include <avr/interrupt.h>
 
 volatile unsigned char BusState = 0;
@@ -52,6 +55,7 @@ volatile unsigned char rxbuffer[MaxFrameIndex + 1];
 volatile uint16_t DataPos = 0;
 volatile unsigned char PacketTopIndex = 7;
 volatile unsigned char modBusStaMaStates = 0;
+volatile uint16_t rxCrc = CRC16_INIT; // running CRC of the frame being received, 0 at the end of a good frame
 
 uint8_t modbusGetBusState(void)
 {
@@ -91,21 +95,9 @@ void transceiver_rxen(void)
  */
 uint8_t crc16(volatile uint8_t *ptrToArray, uint8_t inputSize) // A standard CRC algorithm
 {
-	uint16_t out = 0xffff;
-	uint16_t carry;
-	unsigned char n;
+	uint16_t out;
 	inputSize++;
-	for (int l = 0; l < inputSize; l++)
-	{
-		out ^= ptrToArray[l];
-		for (n = 0; n < 8; n++)
-		{
-			carry = out & 1;
-			out >>= 1;
-			if (carry)
-				out ^= 0xA001;
-		}
-	}
+	out = crc16_update_block(CRC16_INIT, ptrToArray, inputSize);
 	// out=0x1234;
 	if ((ptrToArray[inputSize] == out % 256) && (ptrToArray[inputSize + 1] == out / 256)) // check
 	{
@@ -169,15 +161,15 @@ void modbusTickTimer(void)
 			{ // end of message
 				BusState = (1 << ReceiveCompleted);
 #if ADDRESS_MODE == MULTIPLE_ADR
-				if (crc16(rxbuffer, DataPos - 3))
+				if (rxCrc == 0)
 				{ // perform crc check only. This is for multiple/all address mode.
 				}
 				else
 					modbusReset();
 #endif
 #if ADDRESS_MODE == SINGLE_ADR
-				if (rxbuffer[0] == Address && crc16(rxbuffer, DataPos - 3))
-				{ // is the message for us? => perform crc check
+				if (rxbuffer[0] == Address && rxCrc == 0)
+				{ // is the message for us? => crc residue, folded in by the receive ISR
 				}
 				else
 					modbusReset();
@@ -189,11 +181,11 @@ void modbusTickTimer(void)
 	}
 }
 
-// USART1_RX_vect
-ISR(UART_RECEIVE_INTERRUPT)
+// Handlers of the usart.c driver core, attached to USART by modbusInit().
+// Not used by main.c: frames only end once modbusTickTimer() runs every 100 us, and no timer calls it.
+
+static void modbusRx(uint8_t port, uint8_t status, uint8_t data, uint8_t *woken)
 {
-	unsigned char data;
-	data = UART_DATA;
 	modbusTimer = 0; // reset timer
 	if (!(BusState & (1 << ReceiveCompleted)) && !(BusState & (1 << TransmitRequested)) && !(BusState & (1 << Transmitting)) && (BusState & (1 << Receiving)) && !(BusState & (1 << BusTimedOut)))
 	{
@@ -203,30 +195,35 @@ ISR(UART_RECEIVE_INTERRUPT)
 		{
 			rxbuffer[DataPos] = data;
 			DataPos++; // TODO: maybe prevent this from exceeding 255?
+			rxCrc = crc16_update(rxCrc, data);
 		}
 	}
 	else if (!(BusState & (1 << ReceiveCompleted)) && !(BusState & (1 << TransmitRequested)) && !(BusState & (1 << Transmitting)) && !(BusState & (1 << Receiving)) && (BusState & (1 << BusTimedOut)))
 	{
+#if ADDRESS_MODE == SINGLE_ADR
+		if ((data != Address) && (data != 0))
+		{ // frame for another slave: ignore the rest of it, the timer waits for the silence after it
+			modbusReset();
+			return;
+		}
+#endif
 		rxbuffer[0] = data;
 		BusState = ((1 << Receiving) | (1 << TimerActive));
 		DataPos = 1;
+		rxCrc = crc16_update(CRC16_INIT, data);
 	}
 }
 
-// USART1_UDRE_vect
-ISR(UART_TRANSMIT_INTERRUPT)
+static int16_t modbusUdre(uint8_t port, uint8_t *woken)
 {
+	if (DataPos > PacketTopIndex)
+		return -1; // the driver clears UDRIE, TXC ends the message
 	BusState &= ~(1 << TransmitRequested);
 	BusState |= (1 << Transmitting);
-	UART_DATA = rxbuffer[DataPos];
-	DataPos++;
-	if (DataPos == (PacketTopIndex + 1))
-	{
-		UART_CONTROL &= ~(1 << UART_UDRIE);
-	}
+	return rxbuffer[DataPos++];
 }
 
-ISR(UART_TRANSMIT_COMPLETE_INTERRUPT)
+static void modbusTxc(uint8_t port)
 {
 #if PHYSICAL_TYPE == 485
 	transceiver_rxen();
@@ -234,6 +231,8 @@ ISR(UART_TRANSMIT_COMPLETE_INTERRUPT)
 	modbusReset();
 }
 
+static const __flash usartHandler_t modbusUsart = {modbusRx, modbusUdre, modbusTxc};
+
 void modbusInit(void)
 {
 	UBRRH = (unsigned char)((UBRR) >> 8);
@@ -244,6 +243,7 @@ void modbusInit(void)
 #else
 	UCSRC = (3 << UCSZ0); // Frame Size
 #endif
+	usartAttach(USART, &modbusUsart);
 	UART_CONTROL = (1 << TXCIE) | (1 << RXCIE) | (1 << RXEN) | (1 << TXEN); // USART receiver and transmitter and receive complete interrupt
 #if PHYSICAL_TYPE == 485
 	TRANSCEIVER_ENABLE_PORT_DDR |= (1 << TRANSCEIVER_ENABLE_PIN);
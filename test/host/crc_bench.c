@@ -0,0 +1,96 @@
+/*
+ * crc_bench.c
+ *
+ * Checks the byte table, the nibble table and the bit by bit Modbus CRC16 of
+ * crc16.c against each other on random frames, then times each on 256 bytes.
+ * crc16.c is built twice, the nibble table build with its symbols renamed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crc16.h"
+
+uint16_t crc16_nibble_update_block(uint16_t crc, const volatile uint8_t *buf, uint16_t len);
+
+static int failures;
+
+#define CHECK(cond)                                                   \
+	do                                                                \
+	{                                                                 \
+		if (!(cond))                                                  \
+		{                                                             \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures++;                                               \
+		}                                                             \
+	} while (0)
+
+#define FRAME 256
+#define FRAMES 1000
+#define RUNS 20000
+
+typedef uint16_t (*crc_block_t)(uint16_t crc, const volatile uint8_t *buf, uint16_t len);
+
+static uint8_t frame[FRAME + 2];
+
+static void testMatch(void)
+{
+	uint16_t len, crc;
+	int n, i;
+
+	// 01 03 00 00 00 0A: CRC C5CD, low byte first on the wire
+	static const uint8_t req[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x0A};
+	CHECK(crc16_update_block(CRC16_INIT, req, sizeof(req)) == 0xCDC5);
+
+	srand(1);
+	for (n = 0; n < FRAMES; n++)
+	{
+		len = rand() % (FRAME + 1);
+		for (i = 0; i < len; i++)
+			frame[i] = rand();
+		crc = crc16_update_block(CRC16_INIT, frame, len);
+		CHECK(crc16_nibble_update_block(CRC16_INIT, frame, len) == crc);
+		CHECK(crc16_bitwise_block(CRC16_INIT, frame, len) == crc);
+
+		// The frame followed by its CRC leaves a residue of 0
+		frame[len] = crc;
+		frame[len + 1] = crc >> 8;
+		CHECK(crc16_update_block(CRC16_INIT, frame, len + 2) == 0);
+	}
+}
+
+static double nsPerFrame(crc_block_t block)
+{
+	struct timespec t0, t1;
+	volatile uint16_t sink = 0;
+	int n;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (n = 0; n < RUNS; n++)
+	{
+		frame[0] = n;
+		sink ^= block(CRC16_INIT, frame, FRAME);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	(void)sink;
+	return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / RUNS;
+}
+
+int main(void)
+{
+	double table, nibble, bitwise;
+
+	testMatch();
+
+	table = nsPerFrame(crc16_update_block);
+	nibble = nsPerFrame(crc16_nibble_update_block);
+	bitwise = nsPerFrame(crc16_bitwise_block);
+	printf("CRC16 of %d bytes, ns per frame:\n", FRAME);
+	printf("byte table   %8.0f\n", table);
+	printf("nibble table %8.0f  x%.1f\n", nibble, nibble / table);
+	printf("bitwise      %8.0f  x%.1f\n", bitwise, bitwise / table);
+
+	printf("\ncrc_bench: %s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
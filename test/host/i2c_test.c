@@ -0,0 +1,260 @@
+/*
+ * i2c_test.c
+ *
+ * Drives the RTC and DAC drivers over the unchanged i2cMultiMaster.c and
+ * i2cTransfer.c, on the simulated TWI module of i2cSim.c, and checks the
+ * bus time, transaction counts, retries and error statistics.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <util/delay.h>
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#include "i2cSim.h"
+#include "rtc.h"
+#include "mcp4726.h"
+#include "mcp401x.h"
+
+static int failures;
+
+#define CHECK(cond)                                                   \
+	do                                                                \
+	{                                                                 \
+		if (!(cond))                                                  \
+		{                                                             \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures++;                                               \
+		}                                                             \
+	} while (0)
+
+#define BIT_US (1000000UL / SCL_CLOCK) // START, repeated START or STOP
+
+static I2C_SimDevice_t rtc, dac, pot;
+static uint32_t start_us;
+
+// Let the STOP of the previous transaction go out, then start timing.
+static void timerStart(void)
+{
+	_delay_us(BIT_US);
+	start_us = I2C_Sim_Time_us();
+}
+
+static uint32_t timerRead(void)
+{
+	return I2C_Sim_Time_us() - start_us;
+}
+
+// The transaction takes its bus time, plus at most one poll of the driver.
+// The caller gets the bus back as soon as the STOP is requested, so it is not counted.
+static void checkBusTime(uint32_t elapsed, uint32_t expected)
+{
+	CHECK(elapsed >= expected);
+	CHECK(elapsed <= expected + I2C_POLL_US);
+}
+
+static void testRtc(void)
+{
+	struct tm t;
+	uint32_t us;
+
+	memset(&t, 0, sizeof(t));
+	t.tm_sec = 58;
+	t.tm_min = 59;
+	t.tm_hour = 23;
+	t.tm_mday = 28;
+	t.tm_mon = 1; // February '24, a leap year
+	t.tm_year = 24;
+	t.tm_wday = 3;
+
+	// START, SLA+W, register pointer and 8 registers
+	timerStart();
+	CHECK(setDateTimeDS1307(&t) == pdTRUE);
+	us = timerRead();
+	checkBusTime(us, BIT_US + 10 * I2C_BYTE_TIME_US);
+	printf("DS1307 set      %5lu us\n", (unsigned long)us);
+
+	I2C_Sim_DS1307_Tick(&rtc, 3);
+
+	// START, SLA+W, register pointer, repeated START, SLA+R, 7 registers
+	memset(&t, 0, sizeof(t));
+	timerStart();
+	CHECK(getDateTimeDS1307(&t) == pdTRUE);
+	us = timerRead();
+	checkBusTime(us, BIT_US + 2 * I2C_BYTE_TIME_US + BIT_US + 8 * I2C_BYTE_TIME_US);
+	printf("DS1307 get      %5lu us\n", (unsigned long)us);
+
+	CHECK(t.tm_year == 24);
+	CHECK(t.tm_mon == 1);
+	CHECK(t.tm_mday == 29);
+	CHECK(t.tm_wday == 4);
+	CHECK(t.tm_hour == 0);
+	CHECK(t.tm_min == 0);
+	CHECK(t.tm_sec == 1);
+	CHECK(rtc.count.starts == 3);
+	CHECK(rtc.count.written == 10);
+	CHECK(rtc.count.read == 7);
+}
+
+static void testDac(void)
+{
+	uint32_t us;
+
+	timerStart();
+	CHECK(MCP4726_SetOutput(0xABC) == pdTRUE);
+	us = timerRead();
+	checkBusTime(us, BIT_US + 4 * I2C_BYTE_TIME_US);
+	printf("MCP4726 set     %5lu us\n", (unsigned long)us);
+	CHECK(I2C_Sim_MCP4726_Output(&dac) == 0xABC);
+
+	CHECK(MCP401x_SetWiperValue(0x55) == pdTRUE);
+	timerStart();
+	CHECK(MCP401x_GetWiperValue() == 0x55);
+	us = timerRead();
+	checkBusTime(us, BIT_US + 2 * I2C_BYTE_TIME_US);
+	printf("MCP401x get     %5lu us\n", (unsigned long)us);
+}
+
+static void testRetries(void)
+{
+	I2C_DeviceStats_t *s = I2C_Get_Device_Stats(MCP401x_I2C_ADDRESS);
+	uint32_t us;
+
+	// Two NACKs, the third START gets through.
+	pot.faults.nackAddress = 2;
+	timerStart();
+	CHECK(MCP401x_GetWiperValue() == 0x55);
+	us = timerRead();
+	printf("MCP401x 2 NACKs %5lu us\n", (unsigned long)us);
+	CHECK(s->nacks == 2);
+	CHECK(s->transfers == 3);
+
+	// Every START NACKed, the driver gives up after I2C_MAX_RETRIES.
+	pot.faults.nackAddress = 5;
+	CHECK(MCP401x_GetWiperValue() == MCP401x_ERROR);
+	CHECK(s->nacks == 2 + I2C_MAX_RETRIES);
+	CHECK(pot.faults.nackAddress == 5 - I2C_MAX_RETRIES);
+	CHECK(s->transfers == 3);
+	CHECK(s->timeouts == 0);
+	pot.faults.nackAddress = 0;
+
+	I2C_Sim_Inject_Arb_Lost(1);
+	CHECK(MCP401x_GetWiperValue() == 0x55);
+	CHECK(s->arbLost == 1);
+	CHECK(s->transfers == 4);
+
+	I2C_Sim_Inject_Bus_Error(1);
+	CHECK(MCP401x_GetWiperValue() == MCP401x_ERROR);
+	CHECK(s->busErrors == 1);
+	CHECK(s->timeouts == 0);
+}
+
+static void testTimeouts(void)
+{
+	I2C_DeviceStats_t *s = I2C_Get_Device_Stats(MCP401x_I2C_ADDRESS);
+	uint32_t us;
+
+	// The slave stretches every byte past the deadline. SDA stays free, so no SCL clocking.
+	pot.faults.stretch_us = 2000;
+	timerStart();
+	CHECK(MCP401x_GetWiperValue() == MCP401x_ERROR);
+	us = timerRead();
+	printf("stretch timeout %5lu us, bound %lu us\n", (unsigned long)us, (unsigned long)I2C_WORST_CASE_US(3));
+	CHECK(us <= I2C_WORST_CASE_US(3));
+	CHECK(s->timeouts == 1);
+	CHECK(I2C_Sim_Clocks() == 0);
+	pot.faults.stretch_us = 0;
+	CHECK(MCP401x_GetWiperValue() == 0x55);
+
+	// A slave holds SDA low: 3 SCL pulses release it, one more comes with the STOP.
+	I2C_Sim_Inject_Stuck_Bus(3);
+	timerStart();
+	CHECK(MCP401x_GetWiperValue() == MCP401x_ERROR);
+	us = timerRead();
+	printf("stuck SDA       %5lu us, bound %lu us\n", (unsigned long)us, (unsigned long)I2C_WORST_CASE_US(3));
+	CHECK(us <= I2C_WORST_CASE_US(3));
+	CHECK(s->timeouts == 2);
+	CHECK(I2C_Sim_Recoveries() == 1);
+	CHECK(I2C_Sim_Clocks() == 3 + 1);
+	CHECK(MCP401x_GetWiperValue() == 0x55);
+}
+
+// A transaction that does not fit in I2C_BUFFER_SIZE is refused before the START.
+static void testOversized(void)
+{
+	I2C_DeviceStats_t *s = I2C_Get_Device_Stats(MCP401x_I2C_ADDRESS);
+	uint16_t transfers = s->transfers;
+	uint16_t starts = pot.count.starts;
+	uint8_t reg = 0;
+	uint8_t data[I2C_BUFFER_SIZE];
+	I2C_Transaction_t xfer = {MCP401x_I2C_ADDRESS, &reg, 1, data, I2C_BUFFER_SIZE - 2};
+
+	CHECK(I2C_Master_Transfer(&xfer) == pdFALSE);
+	CHECK(s->oversized == 1);
+	CHECK(s->transfers == transfers);
+	CHECK(pot.count.starts == starts);
+
+	// One byte less just fits.
+	xfer.rxSize = I2C_BUFFER_SIZE - 3;
+	CHECK(I2C_Master_Transfer(&xfer) == pdTRUE);
+	CHECK(s->oversized == 1);
+	CHECK(s->transfers == transfers + 1);
+}
+
+static void testStats(void)
+{
+	I2C_DeviceStats_t *s = I2C_Get_Device_Stats(MCP401x_I2C_ADDRESS);
+	uint16_t transfers = s->transfers;
+	uint8_t i;
+
+	// Another task holds the bus: counted on a known slot, no slot claimed for a new address.
+	CHECK(xSemaphoreTake(xI2CSemaphore, 0) == pdTRUE);
+	CHECK(MCP401x_GetWiperValue() == MCP401x_ERROR);
+	CHECK(s->lockTimeouts == 1);
+	CHECK(s->transfers == transfers);
+	CHECK(I2C_Get_Device_Stats(0xA0) == NULL);
+	CHECK(xSemaphoreGive(xI2CSemaphore) == pdTRUE);
+
+	// DS1307, MCP4726 and MCP401x hold three slots, one is left.
+	CHECK(I2C_Get_Device_Stats(0xA0) != NULL);
+	CHECK(I2C_Get_Device_Stats(0xA2) == NULL);
+
+	// Latency is kept at tick resolution and never above the bound.
+	printf("\naddr xfer nack arb bus tmo lock big max_us\n");
+	for (i = 0; i < I2C_STATS_DEVICES; i++)
+	{
+		s = &I2C_deviceStats[i];
+		printf("0x%02X %4u %4u %3u %3u %3u %4u %3u %6u\n", s->address, s->transfers, s->nacks, s->arbLost,
+			   s->busErrors, s->timeouts, s->lockTimeouts, s->oversized, s->maxLatency_us);
+		CHECK(s->maxLatency_us % (1000000UL / configTICK_RATE_HZ) == 0);
+		CHECK(s->maxLatency_us <= I2C_WORST_CASE_US(I2C_BUFFER_SIZE));
+	}
+	CHECK(I2C_Get_Device_Stats(DS1307)->transfers == 2);
+	CHECK(I2C_Get_Device_Stats(MCP4726_I2C_ADDRESS)->transfers == 1);
+}
+
+int main(void)
+{
+	I2C_Sim_Reset();
+	I2C_Sim_DS1307_Init(&rtc);
+	I2C_Sim_MCP4726_Init(&dac);
+	I2C_Sim_MCP401x_Init(&pot);
+	I2C_Sim_Attach(&rtc);
+	I2C_Sim_Attach(&dac);
+	I2C_Sim_Attach(&pot);
+	I2C_Master_Initialise(0);
+
+	testRtc();
+	testDac();
+	testRetries();
+	testTimeouts();
+	testOversized();
+	testStats();
+
+	printf("\ni2c_test: %s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
@@ -0,0 +1,450 @@
+/*
+ * mb_test.c
+ *
+ * Serves the Modbus RTU slave of modbus.c and the register map code of
+ * mbregmap.c on pseudo terminals, and talks to it from the other side of the
+ * terminal as a master would: every supported function (FC01 to FC2B) with
+ * its exceptions, broken, short, broadcast and foreign frames, the FC08
+ * counters, a read only port, then the request rate at several baud rates.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/eeprom.h>
+
+#include "avr8gpio.h"
+#include "crc16.h"
+#include "mbregmap.h"
+#include "modbus.h"
+
+static int failures;
+
+#define CHECK(cond)                                                   \
+	do                                                                \
+	{                                                                 \
+		if (!(cond))                                                  \
+		{                                                             \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures++;                                               \
+		}                                                             \
+	} while (0)
+
+#define ADDR 17	   // slave address of the read/write port 0
+#define RO_ADDR 5  // slave address of the read only port 1
+#define BAUD 19200 // of the conformance tests
+
+/* The application side: register map, pins, EEPROM files and identification. */
+
+static uint16_t hr[4] = {1, 2, 3, 4};
+static uint32_t total = 100000;
+static float ratio = 1.5f;
+static uint16_t ir[2] = {0x1111, 0x2222};
+static uint32_t pulses = 0x12345678;
+
+static bool validTotal(const void *value)
+{
+	return *(const uint32_t *)value < 1000000UL;
+}
+
+static const mbReg_t holdingRegs[] = {
+	MBREG_U16(0, hr[0], MB_RW, NULL),
+	MBREG_U16(1, hr[1], MB_RW, NULL),
+	MBREG_U16(2, hr[2], MB_RW, NULL),
+	MBREG_U16(3, hr[3], MB_RO, NULL),
+	MBREG_U32(4, total, MB_RW, validTotal),
+	MBREG_FLOAT(6, ratio, MB_RO, NULL),
+};
+
+static const mbReg_t inputRegs[] = {
+	MBREG_U16(0, ir[0], MB_RO, NULL),
+	MBREG_U16(1, ir[1], MB_RO, NULL),
+	MBREG_U32(2, pulses, MB_RO | MB_LSW_FIRST, NULL),
+};
+
+static const mbBit_t coilBits[] = {
+	MBBIT(0, GPHOST(0, 0), MB_RW),
+	MBBIT(1, GPHOST(0, 1), MB_RW),
+	MBBIT(2, GPHOST(0, 2), MB_RW | MB_ACTIVE_LOW),
+};
+
+static const mbBit_t discreteBits[] = {
+	MBBIT(0, GPHOST(1, 0), MB_RO),
+	MBBIT(1, GPHOST(1, 1), MB_RO | MB_ACTIVE_LOW),
+};
+
+static const mbFile_t files[] = {
+	{1, MB_RO, (uint8_t *)0x000, 16},
+	{2, MB_RW, (uint8_t *)0x100, 8},
+};
+
+const mbRegMap_t mbHoldingMap = {holdingRegs, sizeof(holdingRegs) / sizeof(holdingRegs[0])};
+const mbRegMap_t mbInputMap = {inputRegs, sizeof(inputRegs) / sizeof(inputRegs[0])};
+const mbBitMap_t mbCoilMap = {coilBits, sizeof(coilBits) / sizeof(coilBits[0])};
+const mbBitMap_t mbDiscreteMap = {discreteBits, sizeof(discreteBits) / sizeof(discreteBits[0])};
+const mbFileMap_t mbFileMap = {files, sizeof(files) / sizeof(files[0])};
+
+uint8_t mbDeviceObject(uint8_t id, uint8_t *buf, uint8_t size)
+{
+	const char *s;
+	uint8_t len;
+
+	switch (id)
+	{
+	case MB_OBJ_VENDOR:
+		s = "ACME";
+		break;
+	case MB_OBJ_PRODUCT:
+		s = "Meter";
+		break;
+	case MB_OBJ_REVISION:
+		s = "1.0";
+		break;
+	case MB_OBJ_SERIAL:
+		s = "SN42";
+		break;
+	default:
+		return 0;
+	}
+	len = strlen(s);
+	if (buf)
+		memcpy(buf, s, (len < size) ? len : size);
+	return len;
+}
+
+/* The slave side: one thread per port, as the task on the target. */
+
+static pthread_t servers[ModBusPorts];
+static volatile bool serving;
+
+static void *serve(void *arg)
+{
+	uint8_t port = (uintptr_t)arg;
+
+	while (serving)
+		ModBus_HostServe(port, 20);
+	return NULL;
+}
+
+static void serveStart(void)
+{
+	uintptr_t port;
+
+	serving = true;
+	for (port = 0; port < ModBusPorts; port++)
+		pthread_create(&servers[port], NULL, serve, (void *)port);
+}
+
+static void serveStop(void)
+{
+	uint8_t port;
+
+	serving = false;
+	for (port = 0; port < ModBusPorts; port++)
+		pthread_join(servers[port], NULL);
+}
+
+/* The master side. */
+
+static int line[ModBusPorts];
+static uint16_t answered; // answers received on port 0, for its turnaround statistics
+
+static uint32_t usNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+// frame with its CRC, as it goes on the line
+static uint16_t frame(uint8_t *out, const uint8_t *pdu, uint16_t len)
+{
+	uint16_t crc = crc16_update_block(CRC16_INIT, pdu, len);
+
+	memcpy(out, pdu, len);
+	out[len] = crc & 0xFF;
+	out[len + 1] = crc >> 8;
+	return len + 2;
+}
+
+// the answer, up to wait_ms for its first byte, ended by 20 ms of silence
+static uint16_t receive(int fd, uint8_t *buf, uint16_t size, int wait_ms)
+{
+	struct pollfd pfd = {fd, POLLIN, 0};
+	uint16_t len = 0;
+	ssize_t n;
+
+	while ((len < size) && (poll(&pfd, 1, len ? 20 : wait_ms) > 0))
+	{
+		n = read(fd, &buf[len], size - len);
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	return len;
+}
+
+// send req (CRC appended unless raw), the answer must be ans without its CRC, none if ans_len is 0
+static void transact(const char *name, uint8_t port, const uint8_t *req, uint16_t req_len, bool raw,
+					 const uint8_t *ans, uint16_t ans_len)
+{
+	uint8_t out[ModBusFrameSize + 2];
+	uint8_t in[ModBusFrameSize + 2];
+	uint16_t len = raw ? req_len : frame(out, req, req_len);
+	uint16_t got;
+
+	if (raw)
+		memcpy(out, req, req_len);
+	CHECK(write(line[port], out, len) == len);
+	got = receive(line[port], in, sizeof(in), ans_len ? 500 : 200);
+
+	if ((got != (ans_len ? ans_len + 2 : 0)) || (ans_len && memcmp(in, ans, ans_len)) ||
+		(got && (crc16_update_block(CRC16_INIT, in, got) != 0)))
+	{
+		printf("%s: unexpected answer of %u bytes:", name, got);
+		for (len = 0; len < got; len++)
+			printf(" %02X", in[len]);
+		printf("\n");
+		failures++;
+	}
+	if ((port == 0) && got)
+		answered++;
+}
+
+#define BYTES(...) ((const uint8_t[]){__VA_ARGS__})
+#define EXPECT(name, req, ans) transact(name, 0, req, sizeof(req), false, ans, sizeof(ans))
+#define SILENT(name, req) transact(name, 0, req, sizeof(req), false, NULL, 0)
+
+static void testRegisters(void)
+{
+	EXPECT("FC03", BYTES(ADDR, 3, 0, 0, 0, 4), BYTES(ADDR, 3, 8, 0, 1, 0, 2, 0, 3, 0, 4));
+	EXPECT("FC03 U32 float", BYTES(ADDR, 3, 0, 4, 0, 4), BYTES(ADDR, 3, 8, 0x00, 0x01, 0x86, 0xA0, 0x3F, 0xC0, 0, 0));
+	EXPECT("FC03 half float", BYTES(ADDR, 3, 0, 7, 0, 1), BYTES(ADDR, 3, 2, 0, 0));
+	EXPECT("FC03 hole", BYTES(ADDR, 3, 0, 100, 0, 1), BYTES(ADDR, 0x83, 2));
+	EXPECT("FC03 past end", BYTES(ADDR, 3, 0, 6, 0, 3), BYTES(ADDR, 0x83, 2));
+	EXPECT("FC03 count 0", BYTES(ADDR, 3, 0, 0, 0, 0), BYTES(ADDR, 0x83, 3));
+	EXPECT("FC03 count 126", BYTES(ADDR, 3, 0, 0, 0, 126), BYTES(ADDR, 0x83, 3));
+
+	EXPECT("FC04", BYTES(ADDR, 4, 0, 0, 0, 4), BYTES(ADDR, 4, 8, 0x11, 0x11, 0x22, 0x22, 0x56, 0x78, 0x12, 0x34));
+
+	EXPECT("FC06", BYTES(ADDR, 6, 0, 1, 0xBE, 0xEF), BYTES(ADDR, 6, 0, 1, 0xBE, 0xEF));
+	CHECK(hr[1] == 0xBEEF);
+	EXPECT("FC06 read only", BYTES(ADDR, 6, 0, 3, 0, 9), BYTES(ADDR, 0x86, 2));
+	EXPECT("FC06 half U32", BYTES(ADDR, 6, 0, 5, 0, 9), BYTES(ADDR, 0x86, 2));
+
+	EXPECT("FC10", BYTES(ADDR, 16, 0, 4, 0, 2, 4, 0x00, 0x07, 0xA1, 0x20), BYTES(ADDR, 16, 0, 4, 0, 2));
+	CHECK(total == 500000);
+	EXPECT("FC10 refused", BYTES(ADDR, 16, 0, 4, 0, 2, 4, 0x00, 0x0F, 0x42, 0x40), BYTES(ADDR, 0x90, 3));
+	CHECK(total == 500000);
+	EXPECT("FC10 byte count", BYTES(ADDR, 16, 0, 0, 0, 2, 3, 0, 1, 0), BYTES(ADDR, 0x90, 3));
+	EXPECT("FC10 all or none", BYTES(ADDR, 16, 0, 2, 0, 2, 4, 0, 8, 0, 9), BYTES(ADDR, 0x90, 2));
+	CHECK(hr[2] == 3);
+
+	EXPECT("FC17", BYTES(ADDR, 23, 0, 0, 0, 3, 0, 2, 0, 1, 2, 0x00, 0x22),
+		   BYTES(ADDR, 23, 6, 0, 1, 0xBE, 0xEF, 0x00, 0x22));
+	EXPECT("FC17 write count 0", BYTES(ADDR, 23, 0, 0, 0, 1, 0, 2, 0, 0, 0), BYTES(ADDR, 0x97, 3));
+}
+
+static void testBits(void)
+{
+	xHostGpio[0] = 0;
+	xHostGpio[1] = 0x01;
+
+	EXPECT("FC01", BYTES(ADDR, 1, 0, 0, 0, 3), BYTES(ADDR, 1, 1, 0x04));
+	EXPECT("FC01 past end", BYTES(ADDR, 1, 0, 1, 0, 3), BYTES(ADDR, 0x81, 2));
+	EXPECT("FC01 count 2001", BYTES(ADDR, 1, 0, 0, 0x07, 0xD1), BYTES(ADDR, 0x81, 3));
+
+	EXPECT("FC02", BYTES(ADDR, 2, 0, 0, 0, 2), BYTES(ADDR, 2, 1, 0x03));
+	EXPECT("FC02 one", BYTES(ADDR, 2, 0, 1, 0, 1), BYTES(ADDR, 2, 1, 0x01));
+
+	EXPECT("FC05", BYTES(ADDR, 5, 0, 0, 0xFF, 0x00), BYTES(ADDR, 5, 0, 0, 0xFF, 0x00));
+	CHECK(xHostGpio[0] == 0x01);
+	EXPECT("FC05 value", BYTES(ADDR, 5, 0, 0, 0x12, 0x34), BYTES(ADDR, 0x85, 3));
+	EXPECT("FC05 input", BYTES(ADDR, 5, 0, 9, 0xFF, 0x00), BYTES(ADDR, 0x85, 2));
+
+	EXPECT("FC0F", BYTES(ADDR, 15, 0, 0, 0, 3, 1, 0x02), BYTES(ADDR, 15, 0, 0, 0, 3));
+	CHECK(xHostGpio[0] == 0x06); // coil 2 off drives its active low pin high
+	EXPECT("FC01 after FC0F", BYTES(ADDR, 1, 0, 0, 0, 3), BYTES(ADDR, 1, 1, 0x02));
+	EXPECT("FC0F byte count", BYTES(ADDR, 15, 0, 0, 0, 3, 2, 0x02, 0), BYTES(ADDR, 0x8F, 3));
+}
+
+static void testFiles(void)
+{
+	uint16_t i;
+
+	for (i = 0; i <= E2END; i++)
+		xHostEeprom[i] = i;
+
+	EXPECT("FC14", BYTES(ADDR, 20, 7, 6, 0, 1, 0, 2, 0, 3), BYTES(ADDR, 20, 8, 7, 6, 4, 5, 6, 7, 8, 9));
+	EXPECT("FC14 two", BYTES(ADDR, 20, 14, 6, 0, 1, 0, 0, 0, 1, 6, 0, 2, 0, 7, 0, 1),
+		   BYTES(ADDR, 20, 8, 3, 6, 0, 1, 3, 6, 0x0E, 0x0F));
+	EXPECT("FC14 past end", BYTES(ADDR, 20, 7, 6, 0, 1, 0, 15, 0, 2), BYTES(ADDR, 0x94, 2));
+	EXPECT("FC14 reference", BYTES(ADDR, 20, 7, 5, 0, 1, 0, 0, 0, 1), BYTES(ADDR, 0x94, 3));
+
+	EXPECT("FC15", BYTES(ADDR, 21, 11, 6, 0, 2, 0, 1, 0, 2, 0xAA, 0xBB, 0xCC, 0xDD),
+		   BYTES(ADDR, 21, 11, 6, 0, 2, 0, 1, 0, 2, 0xAA, 0xBB, 0xCC, 0xDD));
+	CHECK(!memcmp(&xHostEeprom[0x102], BYTES(0xAA, 0xBB, 0xCC, 0xDD), 4));
+	EXPECT("FC14 written", BYTES(ADDR, 20, 7, 6, 0, 2, 0, 1, 0, 2), BYTES(ADDR, 20, 6, 5, 6, 0xAA, 0xBB, 0xCC, 0xDD));
+	EXPECT("FC15 read only", BYTES(ADDR, 21, 9, 6, 0, 1, 0, 0, 0, 1, 0x55, 0x55), BYTES(ADDR, 0x95, 2));
+	CHECK(xHostEeprom[0] == 0);
+}
+
+static void testIdentification(void)
+{
+	EXPECT("FC2B basic", BYTES(ADDR, 43, 14, 1, 0),
+		   BYTES(ADDR, 43, 14, 1, 0x83, 0, 0, 3, 0, 4, 'A', 'C', 'M', 'E', 1, 5, 'M', 'e', 't', 'e', 'r', 2, 3, '1', '.', '0'));
+	EXPECT("FC2B extended", BYTES(ADDR, 43, 14, 3, 2),
+		   BYTES(ADDR, 43, 14, 3, 0x83, 0, 0, 2, 2, 3, '1', '.', '0', 0x80, 4, 'S', 'N', '4', '2'));
+	EXPECT("FC2B individual", BYTES(ADDR, 43, 14, 4, 0x80), BYTES(ADDR, 43, 14, 4, 0x83, 0, 0, 1, 0x80, 4, 'S', 'N', '4', '2'));
+	EXPECT("FC2B no object", BYTES(ADDR, 43, 14, 4, 0x81), BYTES(ADDR, 0xAB, 2));
+	EXPECT("FC2B MEI type", BYTES(ADDR, 43, 13, 1, 0), BYTES(ADDR, 0xAB, 1));
+	EXPECT("FC2B code", BYTES(ADDR, 43, 14, 5, 0), BYTES(ADDR, 0xAB, 3));
+}
+
+// FC08 counters from a clear, over all kinds of frames
+static void testDiagnostics(void)
+{
+	uint8_t bad[8];
+
+	EXPECT("FC08 echo", BYTES(ADDR, 8, 0, 0, 0x12, 0x34, 0x56), BYTES(ADDR, 8, 0, 0, 0x12, 0x34, 0x56));
+	EXPECT("FC08 clear", BYTES(ADDR, 8, 0, 0x0A, 0, 0), BYTES(ADDR, 8, 0, 0x0A, 0, 0));
+
+	EXPECT("read", BYTES(ADDR, 3, 0, 0, 0, 1), BYTES(ADDR, 3, 2, 0, 1));
+	frame(bad, BYTES(ADDR, 3, 0, 0, 0, 1), 6);
+	bad[7] ^= 0x01;
+	transact("bad CRC", 0, bad, sizeof(bad), true, NULL, 0);
+	transact("short", 0, BYTES(ADDR, 3, 0), 3, true, NULL, 0);
+	EXPECT("unsupported", BYTES(ADDR, 0x30, 0, 0, 0, 1), BYTES(ADDR, 0xB0, 1));
+	SILENT("broadcast", BYTES(0, 6, 0, 0, 0, 7));
+	SILENT("foreign", BYTES(ADDR + 1, 3, 0, 0, 0, 1));
+	CHECK(hr[0] == 7);
+
+	// every query is a frame for us too
+	EXPECT("FC08 bus messages", BYTES(ADDR, 8, 0, 0x0B, 0, 0), BYTES(ADDR, 8, 0, 0x0B, 0, 7));
+	EXPECT("FC08 bus errors", BYTES(ADDR, 8, 0, 0x0C, 0, 0), BYTES(ADDR, 8, 0, 0x0C, 0, 2));
+	EXPECT("FC08 exceptions", BYTES(ADDR, 8, 0, 0x0D, 0, 0), BYTES(ADDR, 8, 0, 0x0D, 0, 1));
+	EXPECT("FC08 server messages", BYTES(ADDR, 8, 0, 0x0E, 0, 0), BYTES(ADDR, 8, 0, 0x0E, 0, 7));
+	EXPECT("FC08 no response", BYTES(ADDR, 8, 0, 0x0F, 0, 0), BYTES(ADDR, 8, 0, 0x0F, 0, 1));
+	EXPECT("FC08 overrun", BYTES(ADDR, 8, 0, 0x12, 0, 0), BYTES(ADDR, 8, 0, 0x12, 0, 0));
+	EXPECT("FC08 sub-function", BYTES(ADDR, 8, 0, 0x15, 0, 0), BYTES(ADDR, 0x88, 1));
+	EXPECT("FC08 length", BYTES(ADDR, 8, 0, 0x0B, 0), BYTES(ADDR, 0x88, 3));
+	EXPECT("FC08 restart", BYTES(ADDR, 8, 0, 0x01, 0, 0), BYTES(ADDR, 8, 0, 0x01, 0, 0));
+	EXPECT("FC08 cleared", BYTES(ADDR, 8, 0, 0x0D, 0, 0), BYTES(ADDR, 8, 0, 0x0D, 0, 0));
+}
+
+// more than T1.5 between two characters breaks the frame, it is not answered
+static void testGap(void)
+{
+	uint8_t req[8];
+
+	frame(req, BYTES(ADDR, 3, 0, 0, 0, 1), 6);
+	CHECK(write(line[0], req, 3) == 3);
+	usleep(1500); // T1.5 is 859 us, T3.5 2005 us at 19200
+	transact("gap", 0, &req[3], 5, true, NULL, 0);
+	EXPECT("after gap", BYTES(ADDR, 3, 0, 0, 0, 1), BYTES(ADDR, 3, 2, 0, 7));
+}
+
+static void testReadOnly(void)
+{
+	transact("RO FC03", 1, BYTES(RO_ADDR, 3, 0, 0, 0, 1), 6, false, BYTES(RO_ADDR, 3, 2, 0, 7), 5);
+	transact("RO FC06", 1, BYTES(RO_ADDR, 6, 0, 0, 0, 1), 6, false, BYTES(RO_ADDR, 0x86, 1), 3);
+	transact("RO FC15", 1, BYTES(RO_ADDR, 21, 9, 6, 0, 2, 0, 0, 0, 1, 0, 0), 12, false, BYTES(RO_ADDR, 0x95, 1), 3);
+	CHECK(hr[0] == 7);
+}
+
+// requests per second of 8 registers reads, each request taking its time on the line.
+// The host scheduler stalls now and then, so the check is on the fastest round trip, not the rate.
+static void testThroughput(void)
+{
+	static const uint32_t bauds[] = {9600, 19200, 57600, 115200};
+	uint8_t req[8], ans[3 + 16 + 2];
+	uint32_t baud, t0, t1, req_us, ideal_us, best_us;
+	uint16_t n;
+	uint8_t i;
+
+	frame(req, BYTES(ADDR, 3, 0, 0, 0, 8), 6);
+	printf("\n  baud   req/s  line limit  best us\n");
+	for (i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++)
+	{
+		baud = bauds[i];
+		serveStop();
+		ModBus_SetBaud(0, baud);
+		serveStart();
+
+		req_us = sizeof(req) * 11000000UL / baud;
+		ideal_us = req_us + ModBus35_US(baud) + sizeof(ans) * 11000000UL / baud;
+		best_us = UINT32_MAX;
+		t0 = usNow();
+		for (n = 0; (uint32_t)(usNow() - t0) < 1000000UL; n++)
+		{
+			t1 = usNow();
+			usleep(req_us);
+			CHECK(write(line[0], req, sizeof(req)) == sizeof(req));
+			if (receive(line[0], ans, sizeof(ans), 500) != sizeof(ans))
+			{
+				failures++;
+				break;
+			}
+			answered++;
+			t1 = usNow() - t1;
+			if (t1 < best_us)
+				best_us = t1;
+		}
+		printf("%6lu %7u %11lu %8lu\n", (unsigned long)baud, n, (unsigned long)(1000000UL / ideal_us), (unsigned long)best_us);
+		CHECK(best_us <= 2 * ideal_us);
+	}
+}
+
+int main(void)
+{
+	const char *name;
+	struct termios tio;
+	uint16_t hist = 0;
+	uint8_t port, i;
+
+	for (port = 0; port < ModBusPorts; port++)
+	{
+		// ptsname() of the next port overwrites the name, open it first
+		name = port ? ModBus_HostOpen(port, RO_ADDR, BAUD, MB_RO) : ModBus_HostOpen(port, ADDR, BAUD, MB_RW);
+		line[port] = name ? open(name, O_RDWR | O_NOCTTY) : -1;
+		if ((line[port] < 0) || tcgetattr(line[port], &tio))
+		{
+			printf("mb_test: no pseudo terminal\n");
+			return 1;
+		}
+		cfmakeraw(&tio); // opening the terminal side reset it, 0x11 would be taken for XON
+		tcsetattr(line[port], TCSANOW, &tio);
+	}
+	serveStart();
+
+	testRegisters();
+	testBits();
+	testFiles();
+	testIdentification();
+	testDiagnostics();
+	testGap();
+	testReadOnly();
+	testThroughput();
+
+	serveStop();
+
+	// FC08 clears leave the turnaround statistics
+	for (i = 0; i < ModBusHistBins; i++)
+		hist += mbDiag[0].hist[i];
+	printf("\nturnaround %u frames, min %u us, avg %u us, max %u us\n", mbDiag[0].lat_count,
+		   mbDiag[0].lat_min, mbDiag[0].lat_avg, mbDiag[0].lat_max);
+	CHECK(mbDiag[0].lat_count == answered);
+	CHECK(hist == answered);
+	CHECK(mbDiag[1].foreign == 0);
+	CHECK(mbDiag[0].foreign == 0); // the FC08 restart came after the foreign frame
+
+	printf("\nmb_test: %s\n", failures ? "FAILED" : "passed");
+	return failures != 0;
+}
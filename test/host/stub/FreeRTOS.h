@@ -0,0 +1,46 @@
+/*
+ * FreeRTOS.h - host stand-in for the kernel headers.
+ *
+ * Only what the libraries compiled by test/host/Makefile use outside their
+ * __AVR__ sections. There is one thread of execution and time does not pass
+ * by itself: vHostAdvance_us() moves it on, and the simulated peripheral
+ * registered with vHostSetPeripheral() catches up every time it does.
+ */
+
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint16_t TickType_t; // configTICK_TYPE_WIDTH_IN_BITS 16, as on the target
+typedef int8_t BaseType_t;
+typedef uint8_t UBaseType_t;
+typedef uint8_t StackType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdFAIL (pdFALSE)
+#define pdPASS (pdTRUE)
+
+#define portMAX_DELAY ((TickType_t)0xffff)
+
+/* Board definitions of the target: configTICK_RATE_HZ, I2C pins, serial buffer sizes. */
+#include "FreeRTOSBoardDefs.h"
+
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((uint64_t)(xTimeInMs) * (uint64_t)configTICK_RATE_HZ) / (uint64_t)1000U))
+
+/* Nothing preempts the single thread of a host build. */
+#define portENTER_CRITICAL()
+#define portEXIT_CRITICAL()
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+#define portYIELD()
+#define taskYIELD()
+
+/* Simulated time, in microseconds since the start of the program. */
+void vHostAdvance_us(uint32_t us);
+uint32_t ulHostTime_us(void);
+void vHostSetPeripheral(void (*step)(void)); // called after every vHostAdvance_us()
+
+#endif /* INC_FREERTOS_H */
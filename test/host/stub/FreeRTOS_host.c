@@ -0,0 +1,86 @@
+/*
+ * FreeRTOS_host.c - the few kernel services of the host stand-in, see FreeRTOS.h.
+ */
+
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+struct QueueDefinition
+{
+	UBaseType_t uxCount; // 1 = mutex free
+};
+
+static uint32_t ulTime_us;
+static void (*pxPeripheral)(void);
+
+void vHostAdvance_us(uint32_t us)
+{
+	ulTime_us += us;
+	if (pxPeripheral != NULL)
+		pxPeripheral();
+}
+
+uint32_t ulHostTime_us(void)
+{
+	return ulTime_us;
+}
+
+void vHostSetPeripheral(void (*step)(void))
+{
+	pxPeripheral = step;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)(ulTime_us / (1000000UL / configTICK_RATE_HZ));
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+	vHostAdvance_us((uint32_t)xTicksToDelay * (1000000UL / configTICK_RATE_HZ));
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+	return taskSCHEDULER_RUNNING;
+}
+
+void vTaskSuspendAll(void)
+{
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+	return pdFALSE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	SemaphoreHandle_t xMutex = malloc(sizeof(struct QueueDefinition));
+
+	if (xMutex != NULL)
+		xMutex->uxCount = 1;
+	return xMutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+{
+	if (xSemaphore->uxCount == 0)
+	{
+		vTaskDelay(xBlockTime);
+		return pdFALSE;
+	}
+	xSemaphore->uxCount = 0;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+	if (xSemaphore->uxCount)
+		return pdFALSE;
+	xSemaphore->uxCount = 1;
+	return pdTRUE;
+}
@@ -0,0 +1,19 @@
+/*
+ * avr/eeprom.h - host stand-in. The EEPROM is an array in RAM, see avr_host.c.
+ */
+
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define E2END 0x0FFF // 4 KiB, as on the ATmega128
+#define EEMEM
+
+extern uint8_t xHostEeprom[E2END + 1];
+
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif /* _AVR_EEPROM_H_ */
@@ -0,0 +1,16 @@
+/*
+ * avr/interrupt.h - host stand-in. A vector becomes a plain function the
+ * simulated peripheral calls.
+ */
+
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+#define ISR(vector, ...) \
+	void vector(void);   \
+	void vector(void)
+
+#define sei()
+#define cli()
+
+#endif /* _AVR_INTERRUPT_H_ */
@@ -0,0 +1,43 @@
+/*
+ * avr/io.h - host stand-in: the ATmega128 registers the host build touches.
+ * The simulated peripheral that owns a register defines it.
+ */
+
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+#include <stdint.h>
+
+#define __AVR_ATmega128__ 1
+
+#define _BV(bit) (1 << (bit))
+
+/* TWI, in i2cSim.c */
+extern volatile uint8_t TWBR;
+extern volatile uint8_t TWCR;
+extern volatile uint8_t TWSR;
+extern volatile uint8_t TWDR;
+extern volatile uint8_t TWAR;
+
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+
+/* Port D carries SCL and SDA, in i2cSim.c */
+extern volatile uint8_t PORTD;
+extern volatile uint8_t DDRD;
+extern volatile uint8_t PIND;
+
+#define PD0 0
+#define PD1 1
+
+/* USART status bits (UCSRnA), modbus.c checks them on every received byte */
+#define UPE1 2
+#define DOR1 3
+#define FE1 4
+
+#endif /* _AVR_IO_H_ */
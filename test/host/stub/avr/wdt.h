@@ -0,0 +1,12 @@
+/*
+ * avr/wdt.h - host stand-in.
+ */
+
+#ifndef _AVR_WDT_H_
+#define _AVR_WDT_H_
+
+#define wdt_reset()
+#define wdt_enable(value)
+#define wdt_disable()
+
+#endif /* _AVR_WDT_H_ */
@@ -0,0 +1,20 @@
+/*
+ * avr8gpio.h - host stand-in. A pin is port * 8 + bit, GPHOST(port, bit), and
+ * reads back from xHostGpio[port] what was written to it, see avr_host.c.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define GPHOST_PORTS 7 // A ... G
+
+extern volatile uint8_t xHostGpio[GPHOST_PORTS];
+
+#define GPHOST(port, bit) (((port) << 3) + (bit))
+
+#define GPBV(port) (1 << ((port) & 7))
+#define GPSET(port) xHostGpio[(port) >> 3] |= GPBV(port)
+#define GPCLEAR(port) xHostGpio[(port) >> 3] &= ~GPBV(port)
+#define GPWRITE(port, on) if (on) {GPSET(port);} else {GPCLEAR(port);}
+#define GPREAD(port) (xHostGpio[(port) >> 3] & GPBV(port))
@@ -0,0 +1,27 @@
+/*
+ * avr_host.c - the EEPROM and port pins of the host stand-ins, see
+ * avr/eeprom.h and avr8gpio.h.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <avr/eeprom.h>
+
+#include "avr8gpio.h"
+
+uint8_t xHostEeprom[E2END + 1];
+volatile uint8_t xHostGpio[GPHOST_PORTS];
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	assert((uintptr_t)src + n <= sizeof(xHostEeprom));
+	memcpy(dst, &xHostEeprom[(uintptr_t)src], n);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	assert((uintptr_t)dst + n <= sizeof(xHostEeprom));
+	memcpy(&xHostEeprom[(uintptr_t)dst], src, n);
+}
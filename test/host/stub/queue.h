@@ -0,0 +1,12 @@
+/*
+ * queue.h - host stand-in, see FreeRTOS.h.
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef struct QueueDefinition *QueueHandle_t;
+
+#endif /* QUEUE_H */
@@ -0,0 +1,20 @@
+/*
+ * semphr.h - host stand-in, see FreeRTOS.h.
+ *
+ * A mutex held by the single thread of a host build cannot be released while
+ * another caller waits for it, so xSemaphoreTake() on a taken mutex lets the
+ * whole timeout pass and fails, as it would on the target.
+ */
+
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+#include "queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore);
+
+#endif /* SEMAPHORE_H */
@@ -0,0 +1,24 @@
+/*
+ * task.h - host stand-in, see FreeRTOS.h.
+ */
+
+#ifndef INC_TASK_H
+#define INC_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+#define tskIDLE_PRIORITY ((UBaseType_t)0U)
+
+#define taskSCHEDULER_SUSPENDED ((BaseType_t)0)
+#define taskSCHEDULER_NOT_STARTED ((BaseType_t)1)
+#define taskSCHEDULER_RUNNING ((BaseType_t)2)
+
+TickType_t xTaskGetTickCount(void); // ulHostTime_us() in ticks
+void vTaskDelay(const TickType_t xTicksToDelay);
+BaseType_t xTaskGetSchedulerState(void);
+void vTaskSuspendAll(void);
+BaseType_t xTaskResumeAll(void);
+
+#endif /* INC_TASK_H */
@@ -0,0 +1,13 @@
+/*
+ * util/delay.h - host stand-in. A busy wait lets simulated time pass.
+ */
+
+#ifndef _UTIL_DELAY_H_
+#define _UTIL_DELAY_H_
+
+#include "FreeRTOS.h"
+
+#define _delay_us(us) vHostAdvance_us((uint32_t)(us))
+#define _delay_ms(ms) vHostAdvance_us((uint32_t)(ms) * 1000UL)
+
+#endif /* _UTIL_DELAY_H_ */